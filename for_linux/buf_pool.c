@@ -0,0 +1,287 @@
+// Block pool and chained buffers, see buf_pool.h
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "buf_pool.h"
+
+#define SLAB_BLOCKS 256 // blocks per slab (1 MB)
+#define CACHE_MAX 64    // blocks a thread may hold before giving some back
+#define CACHE_BATCH 32  // blocks moved to or from the shared list at a time
+
+_Static_assert(sizeof(struct buf_block) == BUF_BLOCK_SIZE, "buf_block must fill exactly one block");
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct buf_block *shared_free;
+static uint64_t nshared;
+static uint64_t nslabs;
+static uint64_t nblocks;
+static uint64_t limit; // in blocks, 0 = none
+
+// Per-thread free list; only its owner ever touches it
+static __thread struct buf_block *cache;
+static __thread int ncache;
+
+void buf_pool_init(size_t max_bytes)
+{
+    pthread_mutex_lock(&lock);
+    limit = max_bytes / BUF_BLOCK_SIZE;
+    pthread_mutex_unlock(&lock);
+}
+
+// Called with the lock held: carve a new slab onto the shared list
+static int grow(void)
+{
+    uint64_t n = SLAB_BLOCKS;
+    struct buf_block *slab;
+
+    if (limit != 0)
+    {
+        if (nblocks >= limit)
+            return -1;
+        if (nblocks + n > limit)
+            n = limit - nblocks;
+    }
+    slab = aligned_alloc(BUF_BLOCK_SIZE, n * sizeof(struct buf_block));
+    if (slab == NULL)
+        return -1;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        slab[i].next = shared_free;
+        shared_free = &slab[i];
+    }
+    nshared += n;
+    nblocks += n;
+    nslabs++;
+    return 0;
+}
+
+struct buf_block *buf_block_alloc(void)
+{
+    struct buf_block *b;
+
+    if (cache == NULL)
+    {
+        pthread_mutex_lock(&lock);
+        if (shared_free == NULL && grow() < 0)
+        {
+            pthread_mutex_unlock(&lock);
+            errno = ENOMEM;
+            return NULL;
+        }
+        for (int i = 0; i < CACHE_BATCH && shared_free != NULL; i++)
+        {
+            b = shared_free;
+            shared_free = b->next;
+            b->next = cache;
+            cache = b;
+            ncache++;
+            nshared--;
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    b = cache;
+    cache = b->next;
+    ncache--;
+    b->next = NULL;
+    b->start = b->end = 0;
+    return b;
+}
+
+// Move up to n cached blocks to the shared list
+static void give_back(int n)
+{
+    pthread_mutex_lock(&lock);
+    while (n-- > 0 && cache != NULL)
+    {
+        struct buf_block *b = cache;
+        cache = b->next;
+        ncache--;
+        b->next = shared_free;
+        shared_free = b;
+        nshared++;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void buf_block_free(struct buf_block *b)
+{
+    b->next = cache;
+    cache = b;
+    if (++ncache > CACHE_MAX)
+        give_back(CACHE_BATCH);
+}
+
+void buf_pool_thread_flush(void)
+{
+    give_back(ncache);
+}
+
+void buf_pool_stats(struct buf_pool_stats *out)
+{
+    pthread_mutex_lock(&lock);
+    out->slabs = nslabs;
+    out->blocks = nblocks;
+    out->shared_free = nshared;
+    out->limit = limit;
+    pthread_mutex_unlock(&lock);
+}
+
+void buf_chain_init(struct buf_chain *c)
+{
+    c->head = c->tail = NULL;
+    c->len = 0;
+}
+
+unsigned char *buf_chain_reserve(struct buf_chain *c, size_t *avail)
+{
+    struct buf_block *t = c->tail;
+
+    if (t == NULL || t->end == BUF_BLOCK_DATA)
+    {
+        struct buf_block *b = buf_block_alloc();
+        if (b == NULL)
+            return NULL;
+        if (t == NULL)
+            c->head = b;
+        else
+            t->next = b;
+        c->tail = t = b;
+    }
+    *avail = BUF_BLOCK_DATA - t->end;
+    return t->data + t->end;
+}
+
+void buf_chain_commit(struct buf_chain *c, size_t n)
+{
+    c->tail->end += (uint32_t)n;
+    c->len += n;
+}
+
+int buf_chain_append(struct buf_chain *c, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    size_t left = n, avail;
+
+    while (left > 0)
+    {
+        unsigned char *dst = buf_chain_reserve(c, &avail);
+        if (dst == NULL)
+        {
+            // undo the partial append so the caller sees all or nothing
+            size_t done = n - left;
+            while (done > 0)
+            {
+                struct buf_block *t = c->tail;
+                size_t take = t->end - t->start < done ? t->end - t->start : done;
+                t->end -= (uint32_t)take;
+                c->len -= take;
+                done -= take;
+                if (done > 0)
+                {
+                    // drop the emptied tail block
+                    struct buf_block *prev = c->head;
+                    while (prev->next != t)
+                        prev = prev->next;
+                    prev->next = NULL;
+                    c->tail = prev;
+                    buf_block_free(t);
+                }
+            }
+            return -1;
+        }
+        size_t take = left < avail ? left : avail;
+        memcpy(dst, p, take);
+        buf_chain_commit(c, take);
+        p += take;
+        left -= take;
+    }
+    return 0;
+}
+
+size_t buf_chain_peek(const struct buf_chain *c, const unsigned char **p)
+{
+    if (c->head == NULL)
+        return 0;
+    *p = c->head->data + c->head->start;
+    return c->head->end - c->head->start;
+}
+
+int buf_chain_iov(const struct buf_chain *c, struct iovec *iov, int max)
+{
+    int n = 0;
+
+    for (struct buf_block *b = c->head; b != NULL && n < max; b = b->next)
+    {
+        if (b->end == b->start)
+            continue;
+        iov[n].iov_base = b->data + b->start;
+        iov[n].iov_len = b->end - b->start;
+        n++;
+    }
+    return n;
+}
+
+const unsigned char *buf_chain_pullup(struct buf_chain *c, size_t n)
+{
+    struct buf_block *h = c->head;
+
+    if (c->len < n || n > BUF_BLOCK_DATA)
+        return NULL;
+    if (h->end - h->start >= n)
+        return h->data + h->start;
+
+    if (h->start + n > BUF_BLOCK_DATA)
+    {
+        memmove(h->data, h->data + h->start, h->end - h->start);
+        h->end -= h->start;
+        h->start = 0;
+    }
+    while (h->end - h->start < n)
+    {
+        struct buf_block *nb = h->next;
+        size_t want = n - (h->end - h->start);
+        size_t have = nb->end - nb->start;
+        size_t take = want < have ? want : have;
+
+        memcpy(h->data + h->end, nb->data + nb->start, take);
+        h->end += (uint32_t)take;
+        nb->start += (uint32_t)take;
+        if (nb->start == nb->end)
+        {
+            h->next = nb->next;
+            if (c->tail == nb)
+                c->tail = h;
+            buf_block_free(nb);
+        }
+    }
+    return h->data + h->start;
+}
+
+void buf_chain_consume(struct buf_chain *c, size_t n)
+{
+    c->len -= n;
+    while (c->head != NULL)
+    {
+        struct buf_block *h = c->head;
+        size_t have = h->end - h->start;
+
+        if (n < have)
+        {
+            h->start += (uint32_t)n;
+            return;
+        }
+        n -= have;
+        c->head = h->next;
+        if (c->head == NULL)
+            c->tail = NULL;
+        buf_block_free(h);
+    }
+}
+
+void buf_chain_clear(struct buf_chain *c)
+{
+    buf_chain_consume(c, c->len);
+}
@@ -0,0 +1,83 @@
+// Pool of fixed-size, cache-line-aligned I/O blocks and the chained buffers built
+// from them.
+//
+// Blocks are carved out of large slabs that are never returned to malloc. Every thread
+// keeps a small private free list and only touches the shared list (under a mutex) to
+// move blocks in batches. Once the slabs for the peak working set exist, steady-state
+// traffic allocates nothing, and buf_pool_init() can put a hard cap on the total.
+//
+// A buf_chain is a FIFO byte queue made of blocks: producers write into the tail,
+// consumers read from the head, and blocks go back to the pool as soon as they are
+// drained, so an idle connection holds no buffer memory at all.
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define BUF_BLOCK_SIZE 4096                 // bytes per block, header included
+#define BUF_BLOCK_DATA (BUF_BLOCK_SIZE - 64) // payload bytes per block
+
+struct buf_block
+{
+    struct buf_block *next;
+    uint32_t start; // valid bytes are data[start, end)
+    uint32_t end;
+    unsigned char data[BUF_BLOCK_DATA] __attribute__((aligned(64)));
+};
+
+struct buf_pool_stats
+{
+    uint64_t slabs;       // slabs malloc'ed since start (the only mallocs the pool makes)
+    uint64_t blocks;      // blocks carved from those slabs
+    uint64_t shared_free; // blocks on the shared free list (per-thread caches not included)
+    uint64_t limit;       // maximum number of blocks, 0 = unlimited
+};
+
+// Optional: cap the pool at max_bytes of blocks. Call before the first allocation.
+void buf_pool_init(size_t max_bytes);
+
+// Returns NULL with errno = ENOMEM when the cap is reached or malloc fails
+struct buf_block *buf_block_alloc(void);
+void buf_block_free(struct buf_block *b);
+
+// Hand the calling thread's cached blocks back to the shared list, e.g. before it exits
+void buf_pool_thread_flush(void);
+
+void buf_pool_stats(struct buf_pool_stats *out);
+
+struct buf_chain
+{
+    struct buf_block *head;
+    struct buf_block *tail;
+    size_t len; // bytes queued
+};
+
+void buf_chain_init(struct buf_chain *c);
+
+// Free space at the tail, allocating a block if needed. Returns a pointer to *avail
+// (> 0) writable bytes, or NULL when the pool is exhausted. Follow with buf_chain_commit.
+unsigned char *buf_chain_reserve(struct buf_chain *c, size_t *avail);
+void buf_chain_commit(struct buf_chain *c, size_t n);
+
+// Copy n bytes in at the tail. Returns 0, or -1 (ENOMEM) with nothing appended.
+int buf_chain_append(struct buf_chain *c, const void *data, size_t n);
+
+// Contiguous bytes at the head: sets *p and returns how many there are (0 if empty)
+size_t buf_chain_peek(const struct buf_chain *c, const unsigned char **p);
+
+// Describe up to max of the queued blocks, head first, for writev()/sendmsg().
+// Returns the number of iovecs filled; follow a send with buf_chain_consume.
+int buf_chain_iov(const struct buf_chain *c, struct iovec *iov, int max);
+
+// Make the first n bytes (n <= BUF_BLOCK_DATA) contiguous and return them, or NULL if
+// fewer than n bytes are queued. Copies only when the bytes straddle a block boundary.
+const unsigned char *buf_chain_pullup(struct buf_chain *c, size_t n);
+
+// Drop n bytes from the head, returning drained blocks to the pool
+void buf_chain_consume(struct buf_chain *c, size_t n);
+
+void buf_chain_clear(struct buf_chain *c);
+
+#endif
@@ -0,0 +1,165 @@
+// Connection table indexed by fd, see conn_table.h
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "conn_table.h"
+
+#define CHUNK_OBJS 1024 // objects allocated at a time
+#define OBJ_ALIGN 64    // objects start on their own cache line
+
+struct slot
+{
+    uint32_t gen; // bumped on every removal, starts at 1 so no handle is ever 0
+    void *obj;    // NULL while the fd is not in the table
+};
+
+struct chunk
+{
+    struct chunk *next;
+};
+
+struct conn_table
+{
+    struct slot *slots; // slots[fd]
+    int nslots;
+    size_t obj_size;
+    void *free_objs;       // recycled objects, linked through their first word
+    struct chunk *chunks;  // every chunk, for conn_table_destroy
+};
+
+struct conn_table *conn_table_create(size_t obj_size)
+{
+    struct conn_table *t = calloc(1, sizeof(*t));
+
+    if (t == NULL)
+        return NULL;
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    t->obj_size = (obj_size + OBJ_ALIGN - 1) & ~(size_t)(OBJ_ALIGN - 1);
+    return t;
+}
+
+void conn_table_destroy(struct conn_table *t)
+{
+    if (t == NULL)
+        return;
+    while (t->chunks != NULL)
+    {
+        struct chunk *c = t->chunks;
+        t->chunks = c->next;
+        free(c);
+    }
+    free(t->slots);
+    free(t);
+}
+
+// Make sure slots[fd] exists, doubling the array so growth is amortised O(1)
+static int reserve_slot(struct conn_table *t, int fd)
+{
+    if (fd < t->nslots)
+        return 0;
+
+    int n = t->nslots ? t->nslots : 1024;
+    while (n <= fd)
+        n *= 2;
+
+    struct slot *s = realloc(t->slots, n * sizeof(*s));
+    if (s == NULL)
+        return -1;
+    for (int i = t->nslots; i < n; i++)
+    {
+        s[i].gen = 1;
+        s[i].obj = NULL;
+    }
+    t->slots = s;
+    t->nslots = n;
+    return 0;
+}
+
+// Carve a new chunk of objects onto the free list. The chunk header takes the first
+// OBJ_ALIGN bytes so the objects stay aligned.
+static int grow(struct conn_table *t)
+{
+    struct chunk *c = aligned_alloc(OBJ_ALIGN, OBJ_ALIGN + CHUNK_OBJS * t->obj_size);
+    char *base;
+
+    if (c == NULL)
+        return -1;
+    c->next = t->chunks;
+    t->chunks = c;
+    base = (char *)c + OBJ_ALIGN;
+    for (int i = CHUNK_OBJS - 1; i >= 0; i--)
+    {
+        void *obj = base + i * t->obj_size;
+        *(void **)obj = t->free_objs;
+        t->free_objs = obj;
+    }
+    return 0;
+}
+
+void *conn_table_insert(struct conn_table *t, int fd)
+{
+    void *obj;
+
+    if (reserve_slot(t, fd) < 0 || (t->free_objs == NULL && grow(t) < 0))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (t->slots[fd].obj != NULL)
+    {
+        errno = EEXIST;
+        return NULL;
+    }
+    obj = t->free_objs;
+    t->free_objs = *(void **)obj;
+    memset(obj, 0, t->obj_size);
+    t->slots[fd].obj = obj;
+    return obj;
+}
+
+void *conn_table_get(struct conn_table *t, int fd)
+{
+    if (fd < 0 || fd >= t->nslots)
+        return NULL;
+    return t->slots[fd].obj;
+}
+
+void conn_table_remove(struct conn_table *t, int fd)
+{
+    void *obj = conn_table_get(t, fd);
+
+    if (obj == NULL)
+        return;
+    t->slots[fd].obj = NULL;
+    t->slots[fd].gen++;
+    if (t->slots[fd].gen == 0)
+        t->slots[fd].gen = 1;
+    *(void **)obj = t->free_objs;
+    t->free_objs = obj;
+}
+
+conn_handle conn_table_handle(struct conn_table *t, int fd)
+{
+    if (conn_table_get(t, fd) == NULL)
+        return CONN_HANDLE_NONE;
+    return (conn_handle)t->slots[fd].gen << 32 | (uint32_t)fd;
+}
+
+void *conn_table_resolve(struct conn_table *t, conn_handle h)
+{
+    int fd = conn_handle_fd(h);
+    void *obj = conn_table_get(t, fd);
+
+    if (obj == NULL || t->slots[fd].gen != (uint32_t)(h >> 32))
+        return NULL;
+    return obj;
+}
+
+void conn_table_foreach(struct conn_table *t, void (*fn)(void *obj, int fd, void *arg), void *arg)
+{
+    for (int fd = 0; fd < t->nslots; fd++)
+        if (t->slots[fd].obj != NULL)
+            fn(t->slots[fd].obj, fd, arg);
+}
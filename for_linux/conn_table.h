@@ -0,0 +1,51 @@
+// Connection table indexed by fd.
+//
+// Per-connection state lives in fixed-size objects carved from large chunks and
+// recycled through a free list, so insert, lookup and removal are O(1) array
+// operations with no per-connection malloc and no fixed client limit: the slot array
+// grows by doubling with the highest fd, which the kernel keeps dense.
+//
+// Each slot carries a generation that is bumped when the connection is removed. A
+// conn_handle (fd + generation) that leaves the loop, e.g. with a pool task that later
+// posts back, resolves to NULL once the connection it named is gone, even if the fd
+// has been reused.
+//
+// A table is not locked; it belongs to the thread that runs its event loop, and
+// handles are only resolved there.
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t conn_handle;
+
+#define CONN_HANDLE_NONE 0 // never returned for a live connection
+
+struct conn_table;
+
+// obj_size bytes of state per connection. Returns NULL and sets errno on failure.
+struct conn_table *conn_table_create(size_t obj_size);
+void conn_table_destroy(struct conn_table *t);
+
+// Zeroed state for a new connection on fd. Returns NULL if fd is already in the
+// table (errno = EEXIST) or memory runs out (ENOMEM).
+void *conn_table_insert(struct conn_table *t, int fd);
+
+// State of the connection on fd, or NULL
+void *conn_table_get(struct conn_table *t, int fd);
+
+// Forget fd and recycle its state. Call before closing the fd.
+void conn_table_remove(struct conn_table *t, int fd);
+
+// Stable name for the connection currently on fd, CONN_HANDLE_NONE if there is none
+conn_handle conn_table_handle(struct conn_table *t, int fd);
+// The connection a handle names, or NULL if it has been removed since
+void *conn_table_resolve(struct conn_table *t, conn_handle h);
+static inline int conn_handle_fd(conn_handle h) { return (int)(uint32_t)h; }
+
+// Call fn with the state and fd of every connection, in fd order. fn may remove the
+// connection it is given, but no other.
+void conn_table_foreach(struct conn_table *t, void (*fn)(void *obj, int fd, void *arg), void *arg);
+
+#endif
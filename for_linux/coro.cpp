@@ -0,0 +1,227 @@
+// C++20 coroutines on the epoll reactor, see coro.hpp
+#include <cerrno>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coro.hpp"
+
+namespace coro
+{
+
+namespace
+{
+
+constexpr std::size_t FRAME_CLASS = 64;   // bytes per size class
+constexpr std::size_t FRAME_CLASSES = 64; // pooled up to 4 KB
+
+struct free_frame
+{
+    free_frame *next;
+};
+
+thread_local free_frame *free_frames[FRAME_CLASSES];
+
+bool do_read(io_op *op)
+{
+    read_op *r = static_cast<read_op *>(op);
+
+    while ((r->result = recv(r->c->fd(), r->buf, r->len, 0)) < 0 && errno == EINTR)
+        ;
+    return !(r->result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+bool do_write(io_op *op)
+{
+    write_op *w = static_cast<write_op *>(op);
+
+    while (w->done < w->len)
+    {
+        ssize_t n = send(w->c->fd(), w->buf + w->done, w->len - w->done, MSG_NOSIGNAL);
+        if (n > 0)
+            w->done += n;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+        else if (errno != EINTR)
+        {
+            w->result = -1;
+            return true;
+        }
+    }
+    w->result = w->len;
+    return true;
+}
+
+bool do_accept(io_op *op)
+{
+    while ((op->result = accept4(op->c->fd(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    return !(op->result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// The readiness flag alone is not enough: it starts out set and stays set after a read
+// that did not drain the socket, so peek to see whether a byte (or EOF) is really there
+bool do_readable(io_op *op)
+{
+    char b;
+    ssize_t n;
+
+    while ((n = recv(op->c->fd(), &b, 1, MSG_PEEK | MSG_DONTWAIT)) < 0 && errno == EINTR)
+        ;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+    op->result = 0; // data, EOF or an error: the read that follows reports which
+    return true;
+}
+
+void wake(struct timer *, void *arg)
+{
+    std::coroutine_handle<>::from_address(arg).resume();
+}
+
+} // namespace
+
+void *frame_alloc(std::size_t size) noexcept
+{
+    std::size_t k = size == 0 ? 0 : (size - 1) / FRAME_CLASS;
+
+    if (k >= FRAME_CLASSES)
+        return malloc(size);
+    if (free_frame *f = free_frames[k])
+    {
+        free_frames[k] = f->next;
+        return f;
+    }
+    return malloc((k + 1) * FRAME_CLASS);
+}
+
+void frame_free(void *p, std::size_t size) noexcept
+{
+    std::size_t k = size == 0 ? 0 : (size - 1) / FRAME_CLASS;
+
+    if (k >= FRAME_CLASSES)
+    {
+        free(p);
+        return;
+    }
+    free_frame *f = static_cast<free_frame *>(p);
+    f->next = free_frames[k];
+    free_frames[k] = f;
+}
+
+bool spawn(task t)
+{
+    if (!t.h_)
+        return false;
+    std::exchange(t.h_, nullptr).resume();
+    return true;
+}
+
+bool io_op::await_ready() noexcept
+{
+    return c->try_now(this);
+}
+
+bool io_op::await_suspend(std::coroutine_handle<> caller) noexcept
+{
+    return c->park(this, caller);
+}
+
+conn::~conn()
+{
+    if (registered_)
+        event_loop_del(loop_, fd_);
+    close(fd_);
+}
+
+read_op conn::read(void *buf, std::size_t len) noexcept
+{
+    read_op op;
+    op.c = this;
+    op.out = false;
+    op.attempt = do_read;
+    op.buf = buf;
+    op.len = len;
+    return op;
+}
+
+write_op conn::write(const void *buf, std::size_t len) noexcept
+{
+    write_op op;
+    op.c = this;
+    op.out = true;
+    op.attempt = do_write;
+    op.buf = static_cast<const char *>(buf);
+    op.len = len;
+    op.done = 0;
+    return op;
+}
+
+io_op conn::readable() noexcept
+{
+    return io_op{this, false, do_readable, -1, {}};
+}
+
+io_op conn::accept() noexcept
+{
+    return io_op{this, false, do_accept, -1, {}};
+}
+
+// Try op if the socket may be ready for it. Returns true when op has finished.
+bool conn::try_now(io_op *op) noexcept
+{
+    bool &ready = op->out ? can_write_ : can_read_;
+
+    if (!ready)
+        return false;
+    if (op->attempt(op))
+        return true;
+    ready = false; // wait for the next edge
+    return false;
+}
+
+// Suspend h until the loop reports the readiness op waits for. Returns false, with
+// op->result = -1 and errno set, if the socket could not be registered.
+bool conn::park(io_op *op, std::coroutine_handle<> h) noexcept
+{
+    if (!registered_)
+    {
+        if (event_loop_add(loop_, fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP, on_event, this) < 0)
+        {
+            op->result = -1;
+            return false;
+        }
+        registered_ = true;
+    }
+    op->h = h;
+    (op->out ? writer_ : reader_) = op;
+    return true;
+}
+
+void conn::on_event(struct event_loop *, int, uint32_t events, void *arg)
+{
+    conn *c = static_cast<conn *>(arg);
+    std::coroutine_handle<> r, w;
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        c->can_read_ = true;
+    if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        c->can_write_ = true;
+    // finish the operations first: resuming a coroutine may destroy c
+    if (c->reader_ != nullptr && c->try_now(c->reader_))
+        r = std::exchange(c->reader_, nullptr)->h;
+    if (c->writer_ != nullptr && c->try_now(c->writer_))
+        w = std::exchange(c->writer_, nullptr)->h;
+    if (r)
+        r.resume();
+    if (w)
+        w.resume();
+}
+
+void sleep_for::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    timer_init(&t, wake, h.address());
+    event_loop_timer_add(loop, &t, ms);
+}
+
+} // namespace coro
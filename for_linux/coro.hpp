@@ -0,0 +1,173 @@
+// C++20 coroutines on the epoll reactor (event_loop.h).
+//
+// Connection logic stays the straight-line code of dostuff() in example_serv.c,
+//
+//     coro::task serve(struct event_loop *loop, int fd)
+//     {
+//         coro::conn c(loop, fd);
+//         char buf[256];
+//         ssize_t n;
+//
+//         while ((n = co_await c.read(buf, sizeof(buf))) > 0)
+//             if (co_await c.write(buf, n) < 0)
+//                 break;
+//     }
+//
+// but every co_await that would block suspends the coroutine back into the loop rather
+// than blocking the thread. A waiting connection costs its coroutine frame, recycled
+// through a per-thread pool, and nothing else: no thread, no stack. Each operation
+// tries the syscall first and only suspends on EAGAIN, which is what the loop's
+// edge-triggered registration needs to never miss a wakeup.
+//
+// Everything here belongs to the thread running the loop. A conn may have one reader
+// (read, readable or accept) and one writer suspended at a time, and must outlive them.
+//
+// Build: compile the C sources with gcc and link them in, e.g.
+//   gcc -O2 -c event_loop.c timer_wheel.c mpsc_ring.c &&
+//   g++ -std=c++20 -O2 -o prog prog.cpp coro.cpp event_loop.o timer_wheel.o mpsc_ring.o -lpthread
+#ifndef CORO_HPP
+#define CORO_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <sys/types.h>
+
+extern "C" {
+#include "event_loop.h"
+}
+
+namespace coro
+{
+
+// Coroutine frame allocator: 64-byte size classes up to 4 KB, each with a per-thread
+// free list that is never trimmed; larger frames come straight from malloc. Returns
+// NULL when out of memory.
+void *frame_alloc(std::size_t size) noexcept;
+void frame_free(void *p, std::size_t size) noexcept;
+
+// Return type of a connection handler. The coroutine does not run until it is handed
+// to spawn(), and its frame is freed as soon as it returns.
+class task
+{
+public:
+    struct promise_type
+    {
+        task get_return_object() noexcept { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        static task get_return_object_on_allocation_failure() noexcept { return task(nullptr); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+        static void *operator new(std::size_t size) noexcept { return frame_alloc(size); }
+        static void operator delete(void *p, std::size_t size) noexcept { frame_free(p, size); }
+    };
+
+    task(task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task()
+    {
+        if (h_)
+            h_.destroy(); // never spawned
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+    friend bool spawn(task t);
+};
+
+// Start t; it runs until its first suspension before spawn returns. Returns false if
+// its frame could not be allocated, in which case none of its body ran.
+bool spawn(task t);
+
+class conn;
+
+// One pending operation on a conn. The awaiters below are the public face of it.
+struct io_op
+{
+    conn *c;
+    bool out;               // waits for EPOLLOUT rather than EPOLLIN
+    bool (*attempt)(io_op *); // try once: false on EAGAIN, else true with result set
+    ssize_t result = -1;
+    std::coroutine_handle<> h;
+
+    bool await_ready() noexcept;
+    bool await_suspend(std::coroutine_handle<> caller) noexcept;
+    ssize_t await_resume() const noexcept { return result; }
+};
+
+struct read_op : io_op
+{
+    void *buf;
+    std::size_t len;
+};
+
+struct write_op : io_op
+{
+    const char *buf;
+    std::size_t len;
+    std::size_t done;
+};
+
+// A socket owned by a coroutine. It is registered with the loop the first time an
+// operation has to wait, so a connection that never blocks never costs an epoll_ctl,
+// and closed by the destructor.
+class conn
+{
+public:
+    conn(struct event_loop *loop, int fd) noexcept : loop_(loop), fd_(fd) {}
+    ~conn();
+    conn(const conn &) = delete;
+    conn &operator=(const conn &) = delete;
+
+    int fd() const noexcept { return fd_; }
+    struct event_loop *loop() const noexcept { return loop_; }
+
+    // co_await: bytes read, 0 at EOF, or -1 with errno set
+    read_op read(void *buf, std::size_t len) noexcept;
+    // co_await: len once all of it is sent, or -1 with errno set (EPIPE when the peer
+    // has gone; SIGPIPE is never raised)
+    write_op write(const void *buf, std::size_t len) noexcept;
+    // co_await: 0 once the socket is readable or at EOF, so a handler can wait for
+    // input before committing a buffer to it; -1 if the wait could not be set up
+    io_op readable() noexcept;
+    // co_await on a listening socket: a new non-blocking, close-on-exec connection, or
+    // -1 with errno set
+    io_op accept() noexcept;
+
+private:
+    friend struct io_op;
+    static void on_event(struct event_loop *loop, int fd, uint32_t events, void *arg);
+    bool try_now(io_op *op) noexcept;
+    bool park(io_op *op, std::coroutine_handle<> h) noexcept;
+
+    struct event_loop *loop_;
+    int fd_;
+    bool registered_ = false;
+    bool can_read_ = true; // cleared on EAGAIN, set again by the loop
+    bool can_write_ = true;
+    io_op *reader_ = nullptr;
+    io_op *writer_ = nullptr;
+};
+
+// co_await sleep_for(loop, ms): resume after ms milliseconds, on the loop's timer wheel.
+// The timer lives in the awaiting coroutine's frame.
+struct sleep_for
+{
+    struct event_loop *loop;
+    uint64_t ms;
+    struct timer t;
+
+    sleep_for(struct event_loop *l, uint64_t delay_ms) noexcept : loop(l), ms(delay_ms) {}
+    bool await_ready() const noexcept { return ms == 0; }
+    void await_suspend(std::coroutine_handle<> h) noexcept;
+    void await_resume() const noexcept {}
+};
+
+} // namespace coro
+
+#endif
@@ -0,0 +1,118 @@
+// Vectorised delimiter scanning, see delim.h
+//
+// Each kernel compares a whole vector against the delimiter, turns the result into a
+// bit mask with movemask and peels the set bits off with count-trailing-zeros, so the
+// cost per byte does not depend on how many delimiters there are. The AVX2 kernel is
+// compiled with a target attribute, so the file needs no special flags and still runs
+// on CPUs without AVX2.
+#include <string.h>
+
+#include "delim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DELIM_X86 1
+#endif
+
+typedef size_t (*scan_fn)(const unsigned char *buf, size_t len, unsigned char delim, uint32_t *pos, size_t max);
+
+static size_t scan_scalar(const unsigned char *buf, size_t len, unsigned char delim, uint32_t *pos, size_t max)
+{
+    const unsigned char *p = buf, *end = buf + len;
+    size_t n = 0;
+
+    while (n < max && p < end && (p = memchr(p, delim, end - p)) != NULL)
+        pos[n++] = (uint32_t)(p++ - buf);
+    return n;
+}
+
+#ifdef DELIM_X86
+// Record the set bits of mask as offsets from base. Returns the new count.
+static inline size_t emit(uint32_t mask, size_t base, uint32_t *pos, size_t n, size_t max)
+{
+    while (mask != 0 && n < max)
+    {
+        pos[n++] = (uint32_t)(base + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static size_t scan_sse2(const unsigned char *buf, size_t len, unsigned char delim,
+                                                         uint32_t *pos, size_t max)
+{
+    const __m128i d = _mm_set1_epi8((char)delim);
+    size_t i = 0, n = 0;
+
+    for (; i + 16 <= len && n < max; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        n = emit((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, d)), i, pos, n, max);
+    }
+    if (n < max && i < len)
+    {
+        size_t k = scan_scalar(buf + i, len - i, delim, pos + n, max - n);
+        for (size_t j = n; j < n + k; j++)
+            pos[j] += (uint32_t)i;
+        n += k;
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static size_t scan_avx2(const unsigned char *buf, size_t len, unsigned char delim,
+                                                         uint32_t *pos, size_t max)
+{
+    const __m256i d = _mm256_set1_epi8((char)delim);
+    size_t i = 0, n = 0;
+
+    // two vectors per step, so the common "no delimiter here" case is one test per 64 bytes
+    for (; i + 64 <= len && n < max; i += 64)
+    {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), d);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 32)), d);
+        if (_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b)))
+            continue;
+        n = emit((uint32_t)_mm256_movemask_epi8(a), i, pos, n, max);
+        n = emit((uint32_t)_mm256_movemask_epi8(b), i + 32, pos, n, max);
+    }
+    for (; i + 32 <= len && n < max; i += 32)
+    {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), d);
+        n = emit((uint32_t)_mm256_movemask_epi8(a), i, pos, n, max);
+    }
+    if (n < max && i < len)
+    {
+        size_t k = scan_scalar(buf + i, len - i, delim, pos + n, max - n);
+        for (size_t j = n; j < n + k; j++)
+            pos[j] += (uint32_t)i;
+        n += k;
+    }
+    return n;
+}
+#endif
+
+static scan_fn pick(void)
+{
+#ifdef DELIM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return scan_sse2;
+#endif
+    return scan_scalar;
+}
+
+static scan_fn scan_impl; // chosen on first use; racing first calls pick the same one
+
+size_t delim_scan(const unsigned char *buf, size_t len, unsigned char delim, uint32_t *pos, size_t max)
+{
+    scan_fn fn = __atomic_load_n(&scan_impl, __ATOMIC_RELAXED);
+
+    if (fn == NULL)
+    {
+        fn = pick();
+        __atomic_store_n(&scan_impl, fn, __ATOMIC_RELAXED);
+    }
+    return fn(buf, len, delim, pos, max);
+}
@@ -0,0 +1,18 @@
+// Vectorised delimiter scanning for newline- and NUL-terminated protocols.
+//
+// One pass over a receive buffer finds every delimiter, 32 bytes per step with AVX2 or
+// 16 with SSE2, chosen at run time from what the CPU supports; other CPUs get a
+// memchr() loop. A burst of small messages is thus split with one scan instead of a
+// strlen() per message.
+#ifndef DELIM_H
+#define DELIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Store the offsets of the first max occurrences of delim in buf[0, len) in pos, in
+// order, and return how many there were. When the result is max, continue from
+// pos[max - 1] + 1 for the rest.
+size_t delim_scan(const unsigned char *buf, size_t len, unsigned char delim, uint32_t *pos, size_t max);
+
+#endif
@@ -0,0 +1,237 @@
+// Edge-triggered epoll reactor, see event_loop.h
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "event_loop.h"
+
+#define MAX_EVENTS 256    // events harvested per epoll_wait call
+#define POST_RING_SIZE 4096 // messages other threads can queue for a loop
+
+// Callback registered for one fd. The table is indexed by fd, which the kernel keeps dense.
+struct event_handler
+{
+    event_cb cb;
+    void *arg;
+    uint64_t removed_in;            // batch in which the fd was last unregistered
+};
+
+struct event_loop
+{
+    int epfd;
+    int running;
+    struct event_handler *handlers; // handlers[fd]
+    int nhandlers;                  // number of slots in handlers[]
+    struct timer_wheel *timers;
+    uint64_t now;                   // ms, refreshed after every epoll_wait
+    uint64_t batch;                 // epoll_wait calls so far, names the events being dispatched
+    struct mpsc_ring *posts;        // messages from other threads
+    int wakefd;                     // eventfd that signals posts
+    int wake_pending;               // set by the first poster after the loop last drained
+    struct epoll_event events[MAX_EVENTS];
+};
+
+static uint64_t clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The wake eventfd fired: run everything posted so far
+static void on_wakeup(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct mpsc_msg msg;
+    uint64_t count;
+    (void)events;
+    (void)arg;
+
+    while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+    // Re-open the door before draining: a post that lands after this point writes
+    // the eventfd again. The exchange pairs with the posters' so their messages are
+    // visible to the pops below.
+    __atomic_exchange_n(&loop->wake_pending, 0, __ATOMIC_ACQ_REL);
+    while (mpsc_ring_pop(loop->posts, &msg))
+        msg.fn(msg.arg, msg.val);
+}
+
+int event_loop_post(struct event_loop *loop, mpsc_fn fn, void *arg, intptr_t val)
+{
+    struct mpsc_msg msg = {fn, arg, val};
+    uint64_t one = 1;
+
+    if (mpsc_ring_push(loop->posts, &msg) < 0)
+        return -1;
+    // Only the first post since the loop last drained pays for the eventfd write
+    if (__atomic_exchange_n(&loop->wake_pending, 1, __ATOMIC_ACQ_REL) == 0)
+        while (write(loop->wakefd, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    return 0;
+}
+
+size_t event_loop_post_depth(struct event_loop *loop)
+{
+    return mpsc_ring_depth(loop->posts);
+}
+
+struct event_loop *event_loop_create(void)
+{
+    struct event_loop *loop = calloc(1, sizeof(*loop));
+    if (loop == NULL)
+        return NULL;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0)
+    {
+        free(loop);
+        return NULL;
+    }
+    loop->now = clock_ms();
+    loop->wakefd = -1;
+    if ((loop->timers = timer_wheel_create(loop->now)) == NULL ||
+        (loop->posts = mpsc_ring_create(POST_RING_SIZE)) == NULL ||
+        (loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        event_loop_add(loop, loop->wakefd, EPOLLIN, on_wakeup, NULL) < 0)
+    {
+        event_loop_destroy(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+void event_loop_destroy(struct event_loop *loop)
+{
+    if (loop == NULL)
+        return;
+    close(loop->epfd);
+    if (loop->wakefd >= 0)
+        close(loop->wakefd);
+    mpsc_ring_destroy(loop->posts);
+    timer_wheel_destroy(loop->timers);
+    free(loop->handlers);
+    free(loop);
+}
+
+// Make sure handlers[fd] exists, doubling the table so growth is amortised O(1)
+static int reserve_handler(struct event_loop *loop, int fd)
+{
+    if (fd < loop->nhandlers)
+        return 0;
+
+    int n = loop->nhandlers ? loop->nhandlers : 64;
+    while (n <= fd)
+        n *= 2;
+
+    struct event_handler *h = realloc(loop->handlers, n * sizeof(*h));
+    if (h == NULL)
+        return -1;
+    memset(h + loop->nhandlers, 0, (n - loop->nhandlers) * sizeof(*h));
+    loop->handlers = h;
+    loop->nhandlers = n;
+    return 0;
+}
+
+int event_loop_add(struct event_loop *loop, int fd, uint32_t events, event_cb cb, void *arg)
+{
+    struct epoll_event ev;
+
+    if (fd < 0 || cb == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reserve_handler(loop, fd) < 0)
+        return -1;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        return -1;
+
+    loop->handlers[fd].cb = cb;
+    loop->handlers[fd].arg = arg;
+    return 0;
+}
+
+int event_loop_mod(struct event_loop *loop, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int event_loop_del(struct event_loop *loop, int fd)
+{
+    if (fd >= 0 && fd < loop->nhandlers)
+    {
+        loop->handlers[fd].cb = NULL;
+        loop->handlers[fd].arg = NULL;
+        loop->handlers[fd].removed_in = loop->batch;
+    }
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+uint64_t event_loop_now(struct event_loop *loop)
+{
+    return __atomic_load_n(&loop->now, __ATOMIC_RELAXED);
+}
+
+void event_loop_timer_add(struct event_loop *loop, struct timer *t, uint64_t delay_ms)
+{
+    timer_wheel_add(loop->timers, t, loop->now + delay_ms);
+}
+
+void event_loop_timer_del(struct event_loop *loop, struct timer *t)
+{
+    timer_wheel_del(loop->timers, t);
+}
+
+void event_loop_stop(struct event_loop *loop)
+{
+    loop->running = 0;
+}
+
+int event_loop_run(struct event_loop *loop)
+{
+    loop->running = 1;
+    while (loop->running)
+    {
+        // Sleep until some fd is ready or the next timer is due, never longer or shorter
+        uint64_t next = timer_wheel_next(loop->timers);
+        int timeout = -1;
+        if (next != UINT64_MAX)
+            timeout = next <= loop->now ? 0 : next - loop->now > INT32_MAX ? INT32_MAX : (int)(next - loop->now);
+
+        int n = epoll_wait(loop->epfd, loop->events, MAX_EVENTS, timeout);
+        __atomic_store_n(&loop->now, clock_ms(), __ATOMIC_RELAXED);
+        loop->batch++;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = loop->events[i].data.fd;
+
+            // The handler may have been removed by an earlier callback in this batch, and
+            // the fd even reused and registered again: the event is for the old one
+            if (fd >= loop->nhandlers || loop->handlers[fd].cb == NULL || loop->handlers[fd].removed_in == loop->batch)
+                continue;
+            loop->handlers[fd].cb(loop, fd, loop->events[i].events, loop->handlers[fd].arg);
+        }
+        timer_wheel_advance(loop->timers, loop->now);
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Edge-triggered epoll reactor shared by the Linux servers.
+//
+// Every registered fd gets one callback. Readiness is reported with EPOLLET, so a
+// callback must keep reading / writing / accepting until the call returns EAGAIN,
+// otherwise it will not be woken again for the data that is already queued.
+//
+// Each loop also owns a timer wheel (timer_wheel.h): epoll_wait sleeps exactly until
+// the next timer is due, and idle loops never wake up at all.
+//
+// Other threads talk to a loop by posting messages (event_loop_post) into its lock-free
+// MPSC ring (mpsc_ring.h); an eventfd wakes the loop, once per batch of posts.
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "timer_wheel.h"
+#include "mpsc_ring.h"
+
+struct event_loop;
+
+// Called with the epoll event mask (EPOLLIN, EPOLLOUT, EPOLLHUP, ...) for fd
+typedef void (*event_cb)(struct event_loop *loop, int fd, uint32_t events, void *arg);
+
+// Create / destroy a reactor. event_loop_create returns NULL and sets errno on failure.
+struct event_loop *event_loop_create(void);
+void event_loop_destroy(struct event_loop *loop);
+
+// Register fd for events (EPOLLET is always added). Returns 0, or -1 with errno set.
+int event_loop_add(struct event_loop *loop, int fd, uint32_t events, event_cb cb, void *arg);
+// Change the interest set of an already registered fd. Unlike add/del this may be
+// called from any thread, e.g. a worker re-arming an EPOLLONESHOT fd it owns; such a
+// worker closes the fd itself instead of calling event_loop_del.
+int event_loop_mod(struct event_loop *loop, int fd, uint32_t events);
+// Unregister fd. Must be called before the fd is closed.
+int event_loop_del(struct event_loop *loop, int fd);
+
+// Dispatch events and timers until event_loop_stop() is called. Blocks in epoll_wait
+// until there is real readiness or a timer is due; there is no periodic wakeup.
+int event_loop_run(struct event_loop *loop);
+void event_loop_stop(struct event_loop *loop);
+
+// Milliseconds on the loop's monotonic clock, as of the last wakeup. Safe to read from
+// any thread.
+uint64_t event_loop_now(struct event_loop *loop);
+
+// Run t (initialised with timer_init) delay_ms from now, re-scheduling it if it is
+// already pending; cancel it with event_loop_timer_del. O(1). Only the thread running
+// the loop may touch its timers, and timer callbacks run on that thread.
+void event_loop_timer_add(struct event_loop *loop, struct timer *t, uint64_t delay_ms);
+void event_loop_timer_del(struct event_loop *loop, struct timer *t);
+
+// Run fn(arg, val) on the loop's thread. May be called from any thread and never
+// blocks. Returns 0, or -1 with errno = EAGAIN when the loop's queue is full.
+int event_loop_post(struct event_loop *loop, mpsc_fn fn, void *arg, intptr_t val);
+// Messages posted to loop that it has not run yet. May be called from any thread.
+size_t event_loop_post_depth(struct event_loop *loop);
+
+#endif
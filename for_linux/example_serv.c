@@ -3,12 +3,31 @@
    This version runs forever, forking off a separate
    process for each connection
    gcc server2.c -lsocket
+
+   With -P it runs as a prefork server instead: a supervisor
+   starts long-lived workers that all accept() on the shared
+   listening socket and handle many connections each.  Workers
+   that die are restarted, and the pool grows towards -M when
+   every worker is busy and shrinks back to -P when idle.
+   -B sets the listen backlog (default SOMAXCONN), so a burst
+   of connections queues in the kernel instead of being refused.
+   usage: example_serv [-P min_workers] [-M max_workers] [-B backlog] port
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 
+#define MAX_WORKERS 256 /* hard cap on the prefork pool */
+
 void dostuff(int); /* function prototype */
 void error(char *msg)
 {
@@ -16,12 +35,213 @@ void error(char *msg)
     exit(1);
 }
 
+/* Is this accept() failure worth surviving?  A connection that
+   was reset while queued, or a passing shortage of fds or memory,
+   must not take the server down: back off briefly and go on. */
+static int accept_transient(int err)
+{
+    if (err == EINTR || err == ECONNABORTED)
+        return 1;
+    if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM)
+    {
+        perror("accept");
+        usleep(100000);
+        return 1;
+    }
+    return 0;
+}
+
+/* One scoreboard slot per worker, in memory shared with the supervisor */
+struct worker_slot
+{
+    pid_t pid;             /* 0 when the slot is free */
+    int busy;              /* set while the worker is serving a connection */
+    unsigned long served;  /* connections handled by this worker */
+};
+
+static struct worker_slot *scoreboard;
+static volatile sig_atomic_t stopping = 0;
+
+static void on_term(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static void on_chld(int sig)
+{
+    (void)sig; /* only here to interrupt the supervisor's sleep() */
+}
+
+/******** WORKER_MAIN() *****************
+ Body of a prefork worker.  It keeps accepting on the
+ listening socket it inherited; the kernel hands each
+ new connection to exactly one of the blocked workers.
+ *****************************************/
+static void worker_main(int sockfd, struct worker_slot *slot)
+{
+    struct sockaddr_in cli_addr;
+    socklen_t clilen;
+    struct sigaction sa;
+    int newsockfd;
+
+    /* SIGTERM from the supervisor: finish the current client, then exit */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_term;
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGCHLD, SIG_DFL);
+
+    while (!stopping)
+    {
+        clilen = sizeof(cli_addr);
+        newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
+        if (newsockfd < 0)
+        {
+            if (accept_transient(errno))
+                continue;
+            error("ERROR on accept");
+        }
+        __atomic_store_n(&slot->busy, 1, __ATOMIC_RELAXED);
+        dostuff(newsockfd);
+        close(newsockfd);
+        slot->served++;
+        __atomic_store_n(&slot->busy, 0, __ATOMIC_RELAXED);
+    }
+    exit(0);
+}
+
+static int spawn_worker(int sockfd)
+{
+    for (int i = 0; i < MAX_WORKERS; i++)
+    {
+        if (scoreboard[i].pid != 0)
+            continue;
+        scoreboard[i].busy = 0;
+        scoreboard[i].served = 0;
+        fflush(stdout); /* or the child inherits and re-prints buffered output */
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("ERROR on fork");
+            return -1;
+        }
+        if (pid == 0)
+            worker_main(sockfd, &scoreboard[i]);
+        scoreboard[i].pid = pid;
+        return 0;
+    }
+    return -1;
+}
+
+/******** RUN_PREFORK() *****************
+ Supervisor loop.  Once a second (or as soon as a
+ child exits) it restarts dead workers and resizes
+ the pool from the busy flags on the scoreboard.
+ *****************************************/
+static void run_prefork(int sockfd, int min_workers, int max_workers)
+{
+    struct sigaction sa;
+    int nworkers = 0;
+
+    scoreboard = mmap(NULL, MAX_WORKERS * sizeof(*scoreboard), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (scoreboard == MAP_FAILED)
+        error("ERROR on mmap");
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_chld;
+    sigaction(SIGCHLD, &sa, NULL);
+    sa.sa_handler = on_term;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    while (nworkers < min_workers && spawn_worker(sockfd) == 0)
+        nworkers++;
+    printf("Prefork: %d workers (max %d)\n", nworkers, max_workers);
+
+    while (!stopping)
+    {
+        int status, idle = 0, idle_victim = -1;
+        pid_t pid;
+
+        /* Reap and replace workers that died */
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            for (int i = 0; i < MAX_WORKERS; i++)
+            {
+                if (scoreboard[i].pid == pid)
+                {
+                    scoreboard[i].pid = 0;
+                    nworkers--;
+                    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                        fprintf(stderr, "worker %d died (status %d), restarting\n", (int)pid, status);
+                }
+            }
+        }
+        while (nworkers < min_workers && spawn_worker(sockfd) == 0)
+            nworkers++;
+
+        for (int i = 0; i < MAX_WORKERS; i++)
+        {
+            if (scoreboard[i].pid == 0)
+                continue;
+            if (!__atomic_load_n(&scoreboard[i].busy, __ATOMIC_RELAXED))
+            {
+                idle++;
+                idle_victim = i;
+            }
+        }
+
+        if (idle == 0 && nworkers < max_workers)
+        {
+            /* Everyone is busy: double the pool, up to the maximum */
+            int grow = nworkers;
+            while (grow-- > 0 && nworkers < max_workers && spawn_worker(sockfd) == 0)
+                nworkers++;
+        }
+        else if (idle > nworkers / 2 + 1 && nworkers > min_workers && idle_victim >= 0)
+        {
+            /* Mostly idle: retire one idle worker per tick */
+            kill(scoreboard[idle_victim].pid, SIGTERM);
+        }
+
+        sleep(1);
+    }
+
+    /* Shut down: let every worker finish its current client */
+    for (int i = 0; i < MAX_WORKERS; i++)
+        if (scoreboard[i].pid != 0)
+            kill(scoreboard[i].pid, SIGTERM);
+    while (wait(NULL) > 0)
+        ;
+}
+
 int main(int argc, char *argv[])
 {
-    int sockfd, newsockfd, portno, clilen, pid;
+    int sockfd, newsockfd, portno, pid, c;
+    int min_workers = 0, max_workers = 0, backlog = SOMAXCONN;
+    socklen_t clilen;
     struct sockaddr_in serv_addr, cli_addr;
 
-    if (argc < 2)
+    while ((c = getopt(argc, argv, "P:M:B:")) != -1)
+    {
+        switch (c)
+        {
+        case 'P':
+            min_workers = atoi(optarg);
+            break;
+        case 'M':
+            max_workers = atoi(optarg);
+            break;
+        case 'B':
+            backlog = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-P min_workers] [-M max_workers] [-B backlog] port\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc)
     {
         fprintf(stderr, "ERROR, no port provided\n");
         exit(1);
@@ -29,22 +249,44 @@ int main(int argc, char *argv[])
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0)
         error("ERROR opening socket");
+    c = 1; /* rebind straight away on restart, even with connections in TIME_WAIT */
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &c, sizeof(c));
     bzero((char *)&serv_addr, sizeof(serv_addr));
-    portno = atoi(argv[1]);
+    portno = atoi(argv[optind]);
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons(portno);
     if (bind(sockfd, (struct sockaddr *)&serv_addr,
              sizeof(serv_addr)) < 0)
         error("ERROR on binding");
-    listen(sockfd, 5);
+    if (listen(sockfd, backlog) < 0)
+        error("ERROR on listen");
+
+    if (min_workers > 0)
+    {
+        if (max_workers < min_workers)
+            max_workers = min_workers * 4;
+        if (max_workers > MAX_WORKERS)
+            max_workers = MAX_WORKERS;
+        if (min_workers > max_workers)
+            min_workers = max_workers;
+        signal(SIGPIPE, SIG_IGN); /* a vanished client must not kill a long-lived worker */
+        run_prefork(sockfd, min_workers, max_workers);
+        return 0;
+    }
+
+    signal(SIGCHLD, SIG_IGN); /* children are reaped automatically, no zombies */
     clilen = sizeof(cli_addr);
     while (1)
     {
         newsockfd = accept(sockfd,
                            (struct sockaddr *)&cli_addr, &clilen);
         if (newsockfd < 0)
+        {
+            if (accept_transient(errno))
+                continue;
             error("ERROR on accept");
+        }
         pid = fork();
         if (pid < 0)
             error("ERROR on fork");
@@ -73,9 +315,14 @@ void dostuff(int sock)
     bzero(buffer, 256);
     n = read(sock, buffer, 255);
     if (n < 0)
-        error("ERROR reading from socket");
+    {
+        /* a client reset is its own problem: the prefork worker goes on accepting */
+        perror("ERROR reading from socket");
+        return;
+    }
     printf("Here is the message: %s\n", buffer);
-    n = write(sock, "I got your message", 18);
+    /* MSG_NOSIGNAL: a client that has gone must not SIGPIPE the worker either */
+    n = send(sock, "I got your message", 18, MSG_NOSIGNAL);
     if (n < 0)
-        error("ERROR writing to socket");
-}
\ No newline at end of file
+        perror("ERROR writing to socket");
+}
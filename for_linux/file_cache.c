@@ -0,0 +1,267 @@
+// mmap()'d hot-file cache, see file_cache.h
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#include "file_cache.h"
+#include "event_loop.h"
+
+#define NBUCKETS 1024 // power of two
+
+struct centry
+{
+    struct file_entry pub;   // must be first: handed out as the caller's file_entry
+    struct centry *hnext;    // hash chain
+    struct centry *prev;     // LRU list, most recent first
+    struct centry *next;
+    int refs;                // held by connections, plus one while in the cache
+    dev_t dev;               // identity checked on hits when there is no inotify
+    ino_t ino;
+    struct timespec mtime;
+    char name[];
+};
+
+struct file_cache
+{
+    int rootfd;
+    int inotify;             // -1: check every hit with fstatat
+    struct event_loop *loop;
+    size_t budget;
+    size_t total;            // bytes mapped by cached entries
+    struct centry *lru_head;
+    struct centry *lru_tail;
+    struct centry *buckets[NBUCKETS];
+};
+
+static unsigned hash_name(const char *s)
+{
+    unsigned h = 2166136261u; // FNV-1a
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h & (NBUCKETS - 1);
+}
+
+static void lru_unlink(struct file_cache *fc, struct centry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        fc->lru_head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        fc->lru_tail = e->prev;
+}
+
+static void lru_push(struct file_cache *fc, struct centry *e)
+{
+    e->prev = NULL;
+    e->next = fc->lru_head;
+    if (fc->lru_head)
+        fc->lru_head->prev = e;
+    else
+        fc->lru_tail = e;
+    fc->lru_head = e;
+}
+
+static void release(struct centry *e)
+{
+    if (--e->refs > 0)
+        return;
+    munmap((void *)e->pub.data, e->pub.size);
+    free(e);
+}
+
+// Take e out of the cache; connections still sending from it keep their mapping
+static void drop(struct file_cache *fc, struct centry *e)
+{
+    struct centry **pp = &fc->buckets[hash_name(e->name)];
+
+    while (*pp != e)
+        pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    lru_unlink(fc, e);
+    fc->total -= e->pub.size;
+    release(e);
+}
+
+static void drop_all(struct file_cache *fc)
+{
+    while (fc->lru_head != NULL)
+        drop(fc, fc->lru_head);
+}
+
+static struct centry *lookup(struct file_cache *fc, const char *name)
+{
+    for (struct centry *e = fc->buckets[hash_name(name)]; e != NULL; e = e->hnext)
+        if (strcmp(e->name, name) == 0)
+            return e;
+    return NULL;
+}
+
+// Directory changes: forget whatever they touched
+static void on_inotify(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct file_cache *fc = arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    (void)events;
+
+    while (1)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        for (char *p = buf; p < buf + n;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            struct centry *e;
+
+            if (ev->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                // Events were lost or the watch is gone: trust nothing cached so far
+                drop_all(fc);
+                if (!(ev->mask & IN_Q_OVERFLOW))
+                {
+                    event_loop_del(loop, fd);
+                    close(fd);
+                    fc->inotify = -1; // from now on every hit is checked with fstatat
+                    return;
+                }
+            }
+            else if (ev->len > 0 && (e = lookup(fc, ev->name)) != NULL)
+                drop(fc, e);
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+}
+
+struct file_cache *file_cache_create(int rootfd, const char *dir, size_t budget, struct event_loop *loop)
+{
+    struct file_cache *fc = calloc(1, sizeof(*fc));
+
+    if (fc == NULL)
+        return NULL;
+    fc->rootfd = rootfd;
+    fc->budget = budget;
+    fc->loop = loop;
+    fc->inotify = -1;
+    if (loop == NULL)
+        return fc;
+    if ((fc->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+        return fc;
+    if (inotify_add_watch(fc->inotify, dir, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0 ||
+        event_loop_add(loop, fc->inotify, EPOLLIN, on_inotify, fc) < 0)
+    {
+        close(fc->inotify);
+        fc->inotify = -1;
+    }
+    return fc;
+}
+
+void file_cache_destroy(struct file_cache *fc)
+{
+    if (fc == NULL)
+        return;
+    drop_all(fc);
+    if (fc->inotify >= 0)
+    {
+        event_loop_del(fc->loop, fc->inotify);
+        close(fc->inotify);
+    }
+    free(fc);
+}
+
+// Without inotify: is e still the file that is on disk under its name?
+static int still_current(struct file_cache *fc, struct centry *e)
+{
+    struct stat st;
+
+    if (fstatat(fc->rootfd, e->name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        return 0;
+    return st.st_dev == e->dev && st.st_ino == e->ino && (uint64_t)st.st_size == e->pub.size &&
+           st.st_mtim.tv_sec == e->mtime.tv_sec && st.st_mtim.tv_nsec == e->mtime.tv_nsec;
+}
+
+// Map name and add it to the cache, evicting from the LRU end to make room. A regular
+// file that cannot be cached is handed back open in *fd, so it is not opened twice.
+static struct centry *load(struct file_cache *fc, const char *name, int *fd, uint64_t *size)
+{
+    size_t len = strlen(name);
+    struct centry *e;
+    struct stat st;
+    void *map;
+
+    if ((*fd = openat(fc->rootfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW)) < 0) // no escaping by symlink
+        return NULL;
+    if (fstat(*fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+    *size = st.st_size;
+    if (st.st_size == 0 || (size_t)st.st_size > fc->budget / 4)
+        return NULL;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, *fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    if ((e = malloc(sizeof(*e) + len + 1)) == NULL)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    close(*fd);
+    *fd = -1;
+    e->pub.data = map;
+    e->pub.size = st.st_size;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime = st.st_mtim;
+    e->refs = 1; // the cache's own
+    memcpy(e->name, name, len + 1);
+
+    while (fc->total + e->pub.size > fc->budget && fc->lru_tail != NULL)
+        drop(fc, fc->lru_tail);
+    e->hnext = fc->buckets[hash_name(name)];
+    fc->buckets[hash_name(name)] = e;
+    lru_push(fc, e);
+    fc->total += e->pub.size;
+    return e;
+}
+
+struct file_entry *file_cache_get(struct file_cache *fc, const char *name, int *fd, uint64_t *size)
+{
+    struct centry *e = lookup(fc, name);
+
+    *fd = -1;
+    if (e != NULL && fc->inotify < 0 && !still_current(fc, e))
+    {
+        drop(fc, e);
+        e = NULL;
+    }
+    if (e == NULL && (e = load(fc, name, fd, size)) == NULL)
+        return NULL;
+    if (fc->lru_head != e)
+    {
+        lru_unlink(fc, e);
+        lru_push(fc, e);
+    }
+    e->refs++;
+    return &e->pub;
+}
+
+void file_cache_put(struct file_cache *fc, struct file_entry *fe)
+{
+    (void)fc;
+    release((struct centry *)fe);
+}
@@ -0,0 +1,44 @@
+// Cache of memory-mapped hot files for file_server.c.
+//
+// A file that fits is opened and mmap()'d once; every later request for it is served
+// straight from the mapping, with no open(), read() or stat(). Entries are kept in LRU
+// order and the least recently used are unmapped whenever the mapped total would pass
+// the budget.
+//
+// An inotify watch on the served directory drops entries as soon as their file is
+// written, replaced or removed. Without inotify (or once its queue overflows) every
+// hit is checked against the file's size, mtime and inode with one fstatat() instead.
+//
+// An entry stays mapped while anyone holds a reference, even after it has been evicted
+// or invalidated, so a connection can keep sending from it. Not locked: a cache
+// belongs to the thread that runs its event loop.
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct event_loop;
+struct file_cache;
+
+struct file_entry
+{
+    const unsigned char *data; // the whole file, read-only
+    uint64_t size;
+};
+
+// Serve names relative to the directory rootfd, opened from path dir. Files larger
+// than budget / 4 are never cached. With loop non-NULL the inotify watch is registered
+// on it. Returns NULL and sets errno on failure.
+struct file_cache *file_cache_create(int rootfd, const char *dir, size_t budget, struct event_loop *loop);
+void file_cache_destroy(struct file_cache *fc);
+
+// The cached mapping of name, mapped now if needed, with a reference the caller must
+// drop with file_cache_put. NULL if it cannot be cached: then *fd is the file, already
+// opened and checked to be a regular one, for the caller to serve the ordinary way and
+// close, with its size in *size (the file was too large, empty or could not be
+// mapped), or -1 if name cannot be served at all.
+struct file_entry *file_cache_get(struct file_cache *fc, const char *name, int *fd, uint64_t *size);
+void file_cache_put(struct file_cache *fc, struct file_entry *e);
+
+#endif
@@ -0,0 +1,457 @@
+// Download a file from file_server.c. The body is moved socket -> pipe -> file with
+// splice(), so like on the server side the data never enters user space.
+//
+// With -n N the file is split into chunks of -c MB that N connections fetch in
+// parallel with ranged GETs, each written in place at its own offset. Finished chunks
+// are recorded in a bitmap in local_name.part; if the transfer is interrupted, running
+// the same command again fetches only the chunks that are missing. A connection that
+// drops is reopened and its chunk requested again, so it costs at most one chunk.
+// Build: gcc -O2 -o file_client file_client.c -lpthread
+//
+// Usage: file_client [-h host] [-p port] [-n connections] [-c chunk_MB] remote_name local_name
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "file_proto.h"
+
+#define PIPE_SIZE (1 << 20)
+#define MAX_CONNS 64
+#define MAX_RETRIES 5          // reconnects per connection before it gives up
+#define RETRY_DELAY_MS 200
+#define PART_MAGIC "FCHUNK01"  // .part header: magic, file size, chunk size, then the bitmap
+#define PART_HDR 24
+
+// Shared by the connections of a chunked transfer
+struct transfer
+{
+    const char *name;           // remote file
+    struct sockaddr_in server;
+    int out;                    // local file, written at each chunk's offset
+    int part;                   // sidecar holding the completed-chunk bitmap
+    uint64_t size;
+    uint64_t chunk;
+    uint64_t nchunks;
+    uint64_t next;              // next chunk index to claim
+    uint64_t fetched;           // bytes received in this run
+    unsigned char *bitmap;      // bit i set once chunk i is on disk
+    pthread_mutex_t lock;       // bitmap and its copy in the .part file
+};
+
+// Read exactly len bytes
+static int read_full(int fd, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t n = recv(fd, (char *)buf + got, len - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return 0;
+}
+
+static int connect_to(const struct sockaddr_in *server)
+{
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (const struct sockaddr *)server, sizeof(*server)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send one request line and read the 8-byte length that answers it into *len
+// (FILE_ERROR if the server refused). Returns 0, or -1 when the connection failed.
+static int request(int sock, const char *line, uint64_t *len)
+{
+    unsigned char hdr[8];
+    int n = strlen(line);
+
+    if (send(sock, line, n, MSG_NOSIGNAL) != n || read_full(sock, hdr, sizeof(hdr)) < 0)
+        return -1;
+    *len = file_get_u64(hdr);
+    return 0;
+}
+
+// Move len bytes from sock into out at *off (or at the file position if off is NULL)
+// through pipefd. Returns the bytes moved, short only if the connection dropped, or -1
+// when writing the file failed.
+static int64_t splice_body(int sock, int pipefd[2], int out, loff_t *off, uint64_t len)
+{
+    uint64_t done = 0;
+
+    while (done < len)
+    {
+        size_t want = len - done > PIPE_SIZE ? PIPE_SIZE : len - done;
+        ssize_t n = splice(sock, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        // drain the pipe into the file
+        for (ssize_t left = n; left > 0;)
+        {
+            ssize_t m = splice(pipefd[0], NULL, out, off, left, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m <= 0)
+                return -1;
+            left -= m;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static int chunk_done(struct transfer *t, uint64_t i)
+{
+    return __atomic_load_n(&t->bitmap[i / 8], __ATOMIC_RELAXED) & (1u << (i % 8));
+}
+
+// Claim the next chunk not yet on disk. Returns its index, or nchunks when none is left.
+static uint64_t claim_chunk(struct transfer *t)
+{
+    uint64_t i;
+
+    do
+        i = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED);
+    while (i < t->nchunks && chunk_done(t, i));
+    return i < t->nchunks ? i : t->nchunks;
+}
+
+// Record chunk i as complete, in memory and in the .part file. The data is synced
+// first, so a crash can never leave a chunk marked that is not on disk.
+static void mark_chunk(struct transfer *t, uint64_t i)
+{
+    if (fdatasync(t->out) < 0)
+    {
+        perror("sync local file"); // left unmarked, so it is fetched again on resume
+        return;
+    }
+    pthread_mutex_lock(&t->lock);
+    __atomic_fetch_or(&t->bitmap[i / 8], 1u << (i % 8), __ATOMIC_RELAXED);
+    if (pwrite(t->part, &t->bitmap[i / 8], 1, PART_HDR + i / 8) != 1)
+        perror("write .part"); // the chunk is fetched again on resume
+    pthread_mutex_unlock(&t->lock);
+}
+
+// One connection: fetch chunks until there are none left. A dropped connection is
+// reopened and the chunk it was on is requested again.
+static void *fetch_chunks(void *arg)
+{
+    struct transfer *t = arg;
+    uint64_t i = claim_chunk(t);
+    int pipefd[2], sock = -1, retries = 0;
+    char line[FILE_MAX_REQUEST];
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        perror("pipe");
+        return NULL;
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    while (i < t->nchunks)
+    {
+        loff_t off = i * t->chunk;
+        uint64_t want = t->size - off < t->chunk ? t->size - off : t->chunk, len;
+        int64_t got = -1;
+
+        if (sock < 0 && (sock = connect_to(&t->server)) < 0)
+            goto retry;
+        snprintf(line, sizeof(line), "GET %s %llu %llu\n", t->name, (unsigned long long)off,
+                 (unsigned long long)want);
+        if (request(sock, line, &len) < 0)
+            goto retry;
+        if (len != want)
+        {
+            fprintf(stderr, "chunk %llu: server sent %llu bytes instead of %llu, has the file changed?\n",
+                    (unsigned long long)i, (unsigned long long)len, (unsigned long long)want);
+            break;
+        }
+        if ((got = splice_body(sock, pipefd, t->out, &off, want)) < 0)
+        {
+            perror("splice to file");
+            break;
+        }
+        __atomic_add_fetch(&t->fetched, got, __ATOMIC_RELAXED);
+        if ((uint64_t)got == want)
+        {
+            mark_chunk(t, i);
+            i = claim_chunk(t);
+            retries = 0;
+            continue;
+        }
+    retry:
+        if (sock >= 0)
+            close(sock);
+        sock = -1;
+        if (++retries > MAX_RETRIES)
+        {
+            fprintf(stderr, "giving up on chunk %llu after %d attempts\n", (unsigned long long)i, MAX_RETRIES);
+            break;
+        }
+        struct timespec pause = {0, RETRY_DELAY_MS * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+
+    if (sock >= 0)
+        close(sock);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return NULL;
+}
+
+// Open local and its .part file, reusing the bitmap when it belongs to the same file
+// size and chunk size and local is still the regular file of that size it describes.
+// Returns the number of chunks already complete, or -1.
+static int64_t open_transfer(struct transfer *t, const char *local)
+{
+    char path[4096];
+    unsigned char hdr[PART_HDR];
+    size_t bytes = (t->nchunks + 7) / 8;
+    int64_t have = 0;
+    struct stat st;
+    int resume;
+
+    if ((t->out = open(local, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) < 0 || fstat(t->out, &st) < 0)
+    {
+        perror(local);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s.part", local);
+    if ((t->part = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    if ((t->bitmap = calloc(bytes, 1)) == NULL)
+        return -1;
+    resume = pread(t->part, hdr, sizeof(hdr), 0) == sizeof(hdr) && memcmp(hdr, PART_MAGIC, 8) == 0 &&
+             file_get_u64(hdr + 8) == t->size && file_get_u64(hdr + 16) == t->chunk &&
+             pread(t->part, t->bitmap, bytes, PART_HDR) == (ssize_t)bytes &&
+             S_ISREG(st.st_mode) && (uint64_t)st.st_size == t->size; // deleted or replaced: start over
+    if (!resume)
+    {
+        memset(t->bitmap, 0, bytes);
+        memcpy(hdr, PART_MAGIC, 8);
+        file_put_u64(hdr + 8, t->size);
+        file_put_u64(hdr + 16, t->chunk);
+        if (ftruncate(t->part, 0) < 0 || pwrite(t->part, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            pwrite(t->part, t->bitmap, bytes, PART_HDR) != (ssize_t)bytes)
+        {
+            perror(path);
+            return -1;
+        }
+        if (ftruncate(t->out, 0) < 0)
+        {
+            perror(local);
+            return -1;
+        }
+    }
+    for (uint64_t i = 0; i < t->nchunks; i++)
+        have += chunk_done(t, i) != 0;
+
+    if (ftruncate(t->out, t->size) < 0) // chunks land in place, in any order
+    {
+        perror(local);
+        return -1;
+    }
+    return have;
+}
+
+static int parallel_download(const struct sockaddr_in *server, const char *remote, const char *local,
+                             int nconns, uint64_t chunk, uint64_t *size)
+{
+    struct transfer t;
+    pthread_t threads[MAX_CONNS];
+    char line[FILE_MAX_REQUEST], path[4096];
+    int64_t have;
+    int sock;
+
+    memset(&t, 0, sizeof(t));
+    t.name = remote;
+    t.server = *server;
+    t.chunk = chunk;
+    pthread_mutex_init(&t.lock, NULL);
+
+    snprintf(line, sizeof(line), "SIZE %s\n", remote);
+    if ((sock = connect_to(server)) < 0 || request(sock, line, &t.size) < 0)
+    {
+        perror("connect");
+        return 1;
+    }
+    close(sock);
+    if (t.size == FILE_ERROR)
+    {
+        fprintf(stderr, "server could not open %s\n", remote);
+        return 1;
+    }
+    t.nchunks = (t.size + chunk - 1) / chunk;
+    if ((have = open_transfer(&t, local)) < 0)
+        return 1;
+    if (have > 0)
+        printf("%s: resuming, %lld of %llu chunks already here\n", local, (long long)have,
+               (unsigned long long)t.nchunks);
+    if ((uint64_t)nconns > t.nchunks - have)
+        nconns = t.nchunks - have > 0 ? (int)(t.nchunks - have) : 1;
+
+    for (int i = 0; i < nconns; i++)
+        if (pthread_create(&threads[i], NULL, fetch_chunks, &t) != 0)
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    for (int i = 0; i < nconns; i++)
+        pthread_join(threads[i], NULL);
+
+    have = 0;
+    for (uint64_t i = 0; i < t.nchunks; i++)
+        have += chunk_done(&t, i) != 0;
+    close(t.out);
+    close(t.part);
+    free(t.bitmap);
+    if ((uint64_t)have < t.nchunks)
+    {
+        fprintf(stderr, "%s: %llu of %llu chunks missing, run again to resume\n", local,
+                (unsigned long long)(t.nchunks - have), (unsigned long long)t.nchunks);
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s.part", local);
+    unlink(path);
+    printf("%s: %d connections, %llu bytes fetched in this run\n", local, nconns, (unsigned long long)t.fetched);
+    *size = t.size;
+    return 0;
+}
+
+static int download(const struct sockaddr_in *server, const char *remote, const char *local, uint64_t *size)
+{
+    int sock, out, pipefd[2];
+    char request_line[FILE_MAX_REQUEST];
+    int64_t done;
+
+    if ((sock = connect_to(server)) < 0)
+    {
+        perror("connect");
+        return 1;
+    }
+    int len = snprintf(request_line, sizeof(request_line), "GET %s\n", remote);
+    if (len >= (int)sizeof(request_line) || request(sock, request_line, size) < 0)
+    {
+        fprintf(stderr, "connection closed before the response header\n");
+        return 1;
+    }
+    if (*size == FILE_ERROR)
+    {
+        fprintf(stderr, "server could not open %s\n", remote);
+        return 1;
+    }
+
+    if ((out = open(local, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    {
+        perror(local);
+        return 1;
+    }
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    if ((done = splice_body(sock, pipefd, out, NULL, *size)) < 0)
+    {
+        perror("splice to file");
+        return 1;
+    }
+    if ((uint64_t)done < *size)
+    {
+        fprintf(stderr, "transfer cut short after %llu of %llu bytes\n", (unsigned long long)done, (unsigned long long)*size);
+        return 1;
+    }
+    close(out);
+    close(sock);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int port = FILE_PORT, opt, nconns = 0, rc;
+    uint64_t chunk = 4 << 20, size = 0;
+    struct sockaddr_in server;
+    struct timespec t0, t1;
+
+    while ((opt = getopt(argc, argv, "h:p:n:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            nconns = atoi(optarg);
+            if (nconns < 1)
+                nconns = 1;
+            if (nconns > MAX_CONNS)
+                nconns = MAX_CONNS;
+            break;
+        case 'c':
+            chunk = (uint64_t)atol(optarg) << 20;
+            if (chunk == 0)
+                goto usage;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (argc - optind != 2 || strlen(argv[optind]) > FILE_MAX_REQUEST - 48)
+        goto usage;
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(host);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (nconns > 0)
+        rc = parallel_download(&server, argv[optind], argv[optind + 1], nconns, chunk, &size);
+    else
+        rc = download(&server, argv[optind], argv[optind + 1], &size);
+    if (rc != 0)
+        return rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%s: %llu bytes in %.3f s (%.1f MB/s)\n", argv[optind + 1], (unsigned long long)size, secs,
+           secs > 0 ? size / secs / 1e6 : 0.0);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-n connections] [-c chunk_MB] remote_name local_name\n", argv[0]);
+    return 1;
+}
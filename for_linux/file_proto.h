@@ -0,0 +1,34 @@
+// Wire format shared by file_server.c and file_client.c
+//
+// Request:  "GET <name>\n"            name is a plain file name inside the served directory
+//           "GET <name> <off> <len>\n" only the len bytes starting at byte off (decimal)
+//           "SIZE <name>\n"           only the file size
+// Response: 8-byte big-endian length, then exactly that many bytes of file data. A
+//           range is clipped to the end of the file, so fewer than len bytes may come.
+//           SIZE answers with the file size and sends no data.
+//           A length of FILE_ERROR means the file could not be served; nothing follows.
+// A connection may carry any number of requests, one after the other.
+#ifndef FILE_PROTO_H
+#define FILE_PROTO_H
+
+#include <stdint.h>
+
+#define FILE_PORT 8890
+#define FILE_MAX_REQUEST 512            // longest request line accepted
+#define FILE_ERROR UINT64_MAX
+
+static inline void file_put_u64(unsigned char *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--, v >>= 8)
+        p[i] = (unsigned char)v;
+}
+
+static inline uint64_t file_get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+#endif
@@ -0,0 +1,527 @@
+// Zero-copy file server on the epoll reactor (protocol in file_proto.h).
+// File data goes from the page cache to the socket with sendfile(), or with -s through
+// a per-connection pipe with splice(); it is never copied into user space.
+//
+// Hot files up to a quarter of the -C budget are kept mmap()'d (file_cache.c) and sent
+// straight from the mapping, header and data in one sendmsg(): a repeated request
+// costs no open, stat or read. With -z those sends use MSG_ZEROCOPY, which pins the
+// mapped pages instead of copying them into the socket buffer.
+// Build: gcc -O2 -o file_server file_server.c file_cache.c event_loop.c timer_wheel.c mpsc_ring.c net_util.c
+//
+// Usage: file_server [-p port] [-d directory] [-s] [-C cache_MB] [-z]
+//   -C N  budget of the mmap cache in MB (default 256, 0 = no cache)
+#define _GNU_SOURCE // accept4, splice, F_SETPIPE_SZ
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "event_loop.h"
+#include "net_util.h"
+#include "file_proto.h"
+#include "file_cache.h"
+
+#define TRUE 1
+#define FALSE 0
+#define PIPE_SIZE (1 << 20) // splice pipe capacity
+#define MAX_FREE_CONNS 1024 // connection structs kept for reuse
+#define ZEROCOPY_MIN (16 * 1024) // smaller sends are cheaper copied than pinned
+
+enum
+{
+    ST_REQUEST, // reading a request line
+    ST_HEADER,  // sending the 8-byte length
+    ST_BODY,    // sending file data
+};
+
+struct conn
+{
+    struct conn *next;   // free list link while parked
+    int fd;
+    int state;
+    uint32_t events;
+    char in[FILE_MAX_REQUEST];
+    size_t in_len;
+    unsigned char hdr[8];
+    size_t hdr_off;
+    int file;            // file being sent, -1 if none
+    struct file_entry *mapped; // or the cached mapping being sent, NULL if none
+    off_t offset;        // next file byte to send
+    uint64_t remaining;  // file bytes still to send
+    int pipefd[2];       // splice mode only, created on first use
+    size_t in_pipe;      // bytes sitting in the pipe
+};
+
+static int rootfd;              // directory files are served from
+static int use_splice = FALSE;
+static int use_zerocopy = FALSE;
+static struct file_cache *cache; // NULL with -C 0
+static struct conn *free_conns; // recycled connections, so steady traffic never mallocs
+static int nfree;
+
+static struct conn *conn_alloc(void)
+{
+    struct conn *c = free_conns;
+
+    if (c == NULL)
+        return malloc(sizeof(*c));
+    free_conns = c->next;
+    nfree--;
+    return c;
+}
+
+static void conn_release(struct conn *c)
+{
+    if (nfree >= MAX_FREE_CONNS)
+    {
+        free(c);
+        return;
+    }
+    c->next = free_conns;
+    free_conns = c;
+    nfree++;
+}
+
+static void close_conn(struct event_loop *loop, struct conn *c)
+{
+    event_loop_del(loop, c->fd);
+    close(c->fd);
+    if (c->file >= 0)
+        close(c->file);
+    if (c->mapped != NULL)
+        file_cache_put(cache, c->mapped);
+    if (c->pipefd[0] >= 0)
+    {
+        close(c->pipefd[0]);
+        close(c->pipefd[1]);
+    }
+    conn_release(c);
+}
+
+// Only plain names inside the served directory, no paths
+static int valid_name(const char *name)
+{
+    return name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL;
+}
+
+static int open_file(const char *name, uint64_t *size)
+{
+    struct stat st;
+    int fd;
+
+    if (!valid_name(name))
+        return -1;
+    // a symlink in the directory could point anywhere: serve regular files only
+    if ((fd = openat(rootfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    return fd;
+}
+
+// Let go of the file or mapping the last response was sent from
+static void finish_request(struct conn *c)
+{
+    if (c->file >= 0)
+    {
+        close(c->file);
+        c->file = -1;
+    }
+    if (c->mapped != NULL)
+    {
+        file_cache_put(cache, c->mapped);
+        c->mapped = NULL;
+    }
+}
+
+// "<off> <len>" after a GET name: the range to send, clipped to size. Returns -1 if
+// the text is not two decimal numbers.
+static int parse_range(const char *s, uint64_t size, uint64_t *off, uint64_t *len)
+{
+    char *end;
+
+    errno = 0;
+    *off = strtoull(s, &end, 10);
+    if (end == s || *end != ' ')
+        return -1;
+    s = end + 1;
+    *len = strtoull(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0)
+        return -1;
+    if (*off > size)
+        *off = size;
+    if (*len > size - *off)
+        *len = size - *off;
+    return 0;
+}
+
+// Parse one complete request line and prepare its response
+static void start_request(struct conn *c, char *line)
+{
+    uint64_t size = 0, off = 0, len = 0;
+    char *range = NULL;
+
+    c->file = -1;
+    if (strncmp(line, "GET ", 4) == 0)
+    {
+        if ((range = strchr(line + 4, ' ')) != NULL)
+            *range++ = '\0';
+        if (cache == NULL || !valid_name(line + 4))
+            c->file = open_file(line + 4, &size);
+        else if ((c->mapped = file_cache_get(cache, line + 4, &c->file, &size)) != NULL)
+            size = c->mapped->size;
+        // else c->file is what the cache could not take, already opened, or -1
+        len = size;
+        if ((c->file >= 0 || c->mapped != NULL) && range != NULL && parse_range(range, size, &off, &len) < 0)
+            finish_request(c);
+        file_put_u64(c->hdr, c->file >= 0 || c->mapped != NULL ? len : FILE_ERROR);
+    }
+    else if (strncmp(line, "SIZE ", 5) == 0 && (c->file = open_file(line + 5, &size)) >= 0)
+    {
+        close(c->file); // the answer is the header alone
+        c->file = -1;
+        file_put_u64(c->hdr, size);
+    }
+    else
+        file_put_u64(c->hdr, FILE_ERROR);
+
+    c->offset = off;
+    c->remaining = c->file >= 0 || c->mapped != NULL ? len : 0;
+    c->hdr_off = 0;
+    c->state = ST_HEADER;
+}
+
+// Cached file: the rest of the header and of the range, gathered into one sendmsg()
+// straight from the mapping. Returns 1 when the response is complete, 0 when the
+// socket is full and -1 on error.
+static int send_mapped(struct conn *c)
+{
+    while (c->hdr_off < sizeof(c->hdr) || c->remaining > 0)
+    {
+        struct iovec iov[2];
+        struct msghdr msg;
+        int n = 0, flags = MSG_NOSIGNAL;
+
+        memset(&msg, 0, sizeof(msg));
+        if (c->hdr_off < sizeof(c->hdr))
+            iov[n++] = (struct iovec){c->hdr + c->hdr_off, sizeof(c->hdr) - c->hdr_off};
+        if (c->remaining > 0)
+            iov[n++] = (struct iovec){(void *)(c->mapped->data + c->offset),
+                                      c->remaining > (1u << 30) ? (1u << 30) : c->remaining};
+        if (use_zerocopy && c->remaining >= ZEROCOPY_MIN)
+            flags |= MSG_ZEROCOPY;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sent = sendmsg(c->fd, &msg, flags);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // ENOBUFS: too many zero-copy sends in flight, wait for their completions
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) ? 0 : -1;
+        }
+        size_t h = sizeof(c->hdr) - c->hdr_off;
+        if ((size_t)sent < h)
+            h = sent;
+        c->hdr_off += h;
+        c->offset += sent - h;
+        c->remaining -= sent - h;
+    }
+    return 1;
+}
+
+// -z: read the completion notices of finished zero-copy sends off the error queue.
+// The kernel keeps the pages pinned until then, so the mapping may be released early.
+// Returns the pending socket error, 0 if there is none.
+static int reap_zerocopy(int fd)
+{
+    char control[128];
+    struct msghdr msg;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    while (TRUE)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+    }
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err;
+}
+
+// Move file data to the socket without touching it. Returns 1 when the body is
+// complete, 0 when the socket is full and -1 on error.
+static int send_body(struct conn *c)
+{
+    while (c->remaining > 0)
+    {
+        ssize_t n;
+
+        if (!use_splice)
+        {
+            size_t chunk = c->remaining > (1u << 30) ? (1u << 30) : c->remaining;
+            n = sendfile(c->fd, c->file, &c->offset, chunk);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return errno == EAGAIN ? 0 : -1;
+            if (n == 0)
+                return -1; // file shrank under us
+            c->remaining -= n;
+            continue;
+        }
+
+        // splice: file -> pipe, then pipe -> socket
+        if (c->in_pipe == 0)
+        {
+            size_t chunk = c->remaining > PIPE_SIZE ? PIPE_SIZE : c->remaining;
+            n = splice(c->file, &c->offset, c->pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return -1;
+            c->in_pipe = n;
+        }
+        n = splice(c->pipefd[0], NULL, c->fd, NULL, c->in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN ? 0 : -1;
+        c->in_pipe -= n;
+        c->remaining -= n;
+    }
+    return 1;
+}
+
+// Drive the connection as far as it goes without blocking. Returns the events to wait
+// for next, or 0 to close.
+static uint32_t serve(struct conn *c)
+{
+    while (TRUE)
+    {
+        if (c->state == ST_REQUEST)
+        {
+            char *nl = memchr(c->in, '\n', c->in_len);
+            if (nl == NULL)
+            {
+                if (c->in_len == sizeof(c->in))
+                    return 0; // request line too long
+                ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+                if (n > 0)
+                {
+                    c->in_len += n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return EPOLLIN;
+                return 0;
+            }
+
+            *nl = '\0';
+            if (nl > c->in && nl[-1] == '\r')
+                nl[-1] = '\0';
+            start_request(c, c->in);
+            // keep any pipelined bytes that followed the request line
+            size_t used = nl + 1 - c->in;
+            memmove(c->in, nl + 1, c->in_len - used);
+            c->in_len -= used;
+        }
+
+        if (c->state == ST_HEADER && c->mapped != NULL)
+        {
+            int rc = send_mapped(c);
+            if (rc < 0)
+                return 0;
+            if (rc == 0)
+                return EPOLLOUT;
+            finish_request(c);
+            c->state = ST_REQUEST;
+            continue;
+        }
+
+        if (c->state == ST_HEADER)
+        {
+            // MSG_MORE lets the length share a segment with the first file bytes
+            ssize_t n = send(c->fd, c->hdr + c->hdr_off, sizeof(c->hdr) - c->hdr_off,
+                             MSG_NOSIGNAL | (c->remaining ? MSG_MORE : 0));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? EPOLLOUT : 0;
+            }
+            c->hdr_off += n;
+            if (c->hdr_off < sizeof(c->hdr))
+                continue;
+            c->state = ST_BODY;
+            if (use_splice && c->remaining > 0 && c->pipefd[0] < 0)
+            {
+                if (pipe2(c->pipefd, O_CLOEXEC | O_NONBLOCK) < 0)
+                {
+                    c->pipefd[0] = c->pipefd[1] = -1;
+                    return 0;
+                }
+                fcntl(c->pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);
+            }
+        }
+
+        if (c->state == ST_BODY)
+        {
+            int rc = c->remaining ? send_body(c) : 1;
+            if (rc < 0)
+                return 0;
+            if (rc == 0)
+                return EPOLLOUT;
+            finish_request(c);
+            c->state = ST_REQUEST;
+        }
+    }
+}
+
+static void on_client(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct conn *c = arg;
+    (void)fd;
+
+    // With -z, EPOLLERR also means zero-copy completions are waiting
+    if ((events & EPOLLERR) && (!use_zerocopy || reap_zerocopy(c->fd) != 0))
+    {
+        close_conn(loop, c);
+        return;
+    }
+    events = serve(c);
+    if (events == 0)
+    {
+        close_conn(loop, c);
+        return;
+    }
+    if (events != c->events)
+    {
+        c->events = events;
+        event_loop_mod(loop, c->fd, events);
+    }
+}
+
+static void on_accept(struct event_loop *loop, int listener, uint32_t events, void *arg)
+{
+    (void)events;
+    (void)arg;
+
+    while (TRUE)
+    {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        struct conn *c = conn_alloc();
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->file = -1;
+        c->pipefd[0] = c->pipefd[1] = -1;
+        if (use_zerocopy)
+        {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+        }
+        c->state = ST_REQUEST;
+        c->events = EPOLLIN;
+        if (event_loop_add(loop, fd, c->events, on_client, c) < 0)
+        {
+            close(fd);
+            conn_release(c);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int port = FILE_PORT, listener, opt;
+    size_t cache_mb = 256;
+    const char *dir = ".";
+    struct event_loop *loop;
+
+    while ((opt = getopt(argc, argv, "p:d:sC:z")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 's':
+            use_splice = TRUE;
+            break;
+        case 'C':
+            cache_mb = (size_t)atol(optarg);
+            break;
+        case 'z':
+            use_zerocopy = TRUE;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-d directory] [-s] [-C cache_MB] [-z]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    raise_fd_limit();
+    if ((rootfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+    if ((listener = tcp_listen(port, SOMAXCONN, FALSE)) < 0)
+    {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+    if ((loop = event_loop_create()) == NULL || event_loop_add(loop, listener, EPOLLIN, on_accept, NULL) < 0)
+    {
+        perror("event_loop");
+        exit(EXIT_FAILURE);
+    }
+    if (cache_mb > 0 && (cache = file_cache_create(rootfd, dir, cache_mb << 20, loop)) == NULL)
+    {
+        perror("file_cache_create");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Serving %s on port %d with %s, %zu MB mmap cache%s\n", dir, port, use_splice ? "splice" : "sendfile",
+           cache_mb, use_zerocopy ? " (MSG_ZEROCOPY)" : "");
+    if (event_loop_run(loop) < 0)
+    {
+        perror("event_loop_run");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
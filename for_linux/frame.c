@@ -0,0 +1,61 @@
+// Length-prefixed binary framing, see frame.h
+#include "frame.h"
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t get_u16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void put_u16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+long frame_parse(const unsigned char *buf, size_t len, size_t max_payload, struct frame *f)
+{
+    uint32_t plen;
+
+    if (len < FRAME_HDR_LEN)
+        return 0;
+    plen = get_u32(buf);
+    if (plen > max_payload || plen > FRAME_MAX_PAYLOAD)
+        return -1;
+    if (len - FRAME_HDR_LEN < plen)
+        return 0;
+
+    f->len = plen;
+    f->type = get_u16(buf + 4);
+    f->flags = get_u16(buf + 6);
+    f->id = get_u32(buf + 8);
+    f->payload = buf + FRAME_HDR_LEN;
+    return (long)(FRAME_HDR_LEN + plen);
+}
+
+size_t frame_size(const unsigned char *buf, size_t len)
+{
+    if (len < FRAME_HDR_LEN)
+        return 0;
+    return FRAME_HDR_LEN + (size_t)get_u32(buf);
+}
+
+void frame_put_header(unsigned char *hdr, uint32_t len, uint16_t type, uint16_t flags, uint32_t id)
+{
+    put_u32(hdr, len);
+    put_u16(hdr + 4, type);
+    put_u16(hdr + 6, flags);
+    put_u32(hdr + 8, id);
+}
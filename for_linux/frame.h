@@ -0,0 +1,45 @@
+// Length-prefixed binary framing.
+//
+// Every message is a 12-byte header followed by len payload bytes:
+//     u32 len | u16 type | u16 flags | u32 id        (all big-endian)
+// id is an opaque correlation id that replies carry back unchanged (0 if unused).
+//
+// The decoder is incremental and zero-copy: hand it whatever has been received so far,
+// in any split, and it returns views whose payload points straight into that buffer.
+// Bytes of an unfinished frame are left for the caller to keep until more arrive.
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_HDR_LEN 12
+#define FRAME_MAX_PAYLOAD (16u << 20) // hard upper bound on a frame's payload
+
+// Message types used by the servers in this directory
+enum
+{
+    FRAME_ECHO = 1,       // reply with the same payload
+    FRAME_ECHO_REPLY = 2,
+};
+
+struct frame
+{
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t id;
+    const unsigned char *payload; // points into the buffer given to frame_parse
+};
+
+// Decode one frame from the start of buf. Returns the number of bytes it occupies
+// (header + payload) and fills *f, 0 if buf does not hold a complete frame yet, or -1
+// if the header announces more than max_payload bytes.
+long frame_parse(const unsigned char *buf, size_t len, size_t max_payload, struct frame *f);
+
+// Total size of the frame starting at buf, or 0 if not even the header is there
+size_t frame_size(const unsigned char *buf, size_t len);
+
+void frame_put_header(unsigned char *hdr, uint32_t len, uint16_t type, uint16_t flags, uint32_t id);
+
+#endif
@@ -0,0 +1,85 @@
+// Log-linear latency histogram, see hdr_hist.h
+#include <string.h>
+
+#include "hdr_hist.h"
+
+#define SUB_COUNT (1 << HDR_SUB_BITS)    // 128 linear buckets below 2^HDR_SUB_BITS
+#define HALF_COUNT (SUB_COUNT / 2)       // buckets per power of two above that
+
+static int bucket_index(uint64_t v)
+{
+    if (v < SUB_COUNT)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - (HDR_SUB_BITS - 1); // keeps the top HDR_SUB_BITS bits, sub in [64, 127]
+    int sub = (int)(v >> shift);
+    return SUB_COUNT + (shift - 1) * HALF_COUNT + (sub - HALF_COUNT);
+}
+
+// Highest value that maps to bucket i
+static uint64_t bucket_value(int i)
+{
+    if (i < SUB_COUNT)
+        return (uint64_t)i;
+    int shift = (i - SUB_COUNT) / HALF_COUNT + 1;
+    uint64_t sub = (uint64_t)((i - SUB_COUNT) % HALF_COUNT + HALF_COUNT);
+    return ((sub + 1) << shift) - 1;
+}
+
+void hdr_init(struct hdr_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hdr_record(struct hdr_hist *h, uint64_t value)
+{
+    h->counts[bucket_index(value)]++;
+    h->count++;
+    h->sum += (double)value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+void hdr_merge(struct hdr_hist *dst, const struct hdr_hist *src)
+{
+    for (int i = 0; i < HDR_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t hdr_percentile(const struct hdr_hist *h, double p)
+{
+    uint64_t target, seen = 0;
+
+    if (h->count == 0)
+        return 0;
+    if (p >= 100.0)
+        return h->max;
+    target = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+    if (target == 0)
+        target = 1;
+
+    for (int i = 0; i < HDR_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= target)
+        {
+            uint64_t v = bucket_value(i);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+double hdr_mean(const struct hdr_hist *h)
+{
+    return h->count ? h->sum / (double)h->count : 0.0;
+}
@@ -0,0 +1,32 @@
+// Log-linear latency histogram in the style of HdrHistogram.
+//
+// Values (e.g. nanoseconds) are bucketed with 7 bits of precision, so any recorded
+// value is reported within 1/64 (~1.6%) of its true value, from 0 up to 2^63.
+// Recording is a couple of instructions and never allocates; histograms from several
+// threads are combined with hdr_merge().
+#ifndef HDR_HIST_H
+#define HDR_HIST_H
+
+#include <stdint.h>
+
+#define HDR_SUB_BITS 7
+#define HDR_BUCKETS ((1 << HDR_SUB_BITS) + (63 - HDR_SUB_BITS + 1) * (1 << (HDR_SUB_BITS - 1)))
+
+struct hdr_hist
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t counts[HDR_BUCKETS];
+};
+
+void hdr_init(struct hdr_hist *h);
+void hdr_record(struct hdr_hist *h, uint64_t value);
+// Add every sample of src to dst
+void hdr_merge(struct hdr_hist *dst, const struct hdr_hist *src);
+// Smallest recorded value v such that at least p percent of samples are <= v (p in 0..100)
+uint64_t hdr_percentile(const struct hdr_hist *h, double p);
+double hdr_mean(const struct hdr_hist *h);
+
+#endif
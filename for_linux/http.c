@@ -0,0 +1,168 @@
+// Incremental, zero-copy HTTP/1.x request parser, see http.h
+#define _GNU_SOURCE // memmem
+#include <stddef.h> // offsetof
+#include <string.h>
+#include <strings.h>
+
+#include "http.h"
+
+int http_view_eq(struct http_view v, const char *s)
+{
+    return v.len == strlen(s) && strncasecmp(v.p, s, v.len) == 0;
+}
+
+struct http_view http_header_get(const struct http_request *req, const char *name)
+{
+    for (int i = 0; i < req->nheaders; i++)
+        if (http_view_eq(req->headers[i].name, name))
+            return req->headers[i].value;
+    return (struct http_view){NULL, 0};
+}
+
+// Is the comma-separated list v made of tokens one of which is token?
+static int list_has(struct http_view v, const char *token)
+{
+    const char *p = v.p, *end = v.p + v.len;
+
+    while (p < end)
+    {
+        const char *comma = memchr(p, ',', end - p);
+        const char *e = comma ? comma : end;
+        struct http_view item;
+
+        while (p < e && (*p == ' ' || *p == '\t'))
+            p++;
+        item.p = p;
+        while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+            e--;
+        item.len = e - p;
+        if (http_view_eq(item, token))
+            return 1;
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+// Split off the next line of [*p, end), without its CRLF (a bare LF is accepted)
+static struct http_view next_line(const char **p, const char *end)
+{
+    const char *nl = memchr(*p, '\n', end - *p);
+    struct http_view line = {*p, nl - *p};
+
+    if (line.len > 0 && line.p[line.len - 1] == '\r')
+        line.len--;
+    *p = nl + 1;
+    return line;
+}
+
+static int parse_request_line(struct http_view line, struct http_request *req)
+{
+    const char *p = line.p, *end = line.p + line.len;
+    const char *sp1 = memchr(p, ' ', end - p), *sp2;
+
+    if (sp1 == NULL || sp1 == p)
+        return -1;
+    req->method = (struct http_view){p, sp1 - p};
+    p = sp1 + 1;
+    if ((sp2 = memchr(p, ' ', end - p)) == NULL || sp2 == p)
+        return -1;
+    req->target = (struct http_view){p, sp2 - p};
+    p = sp2 + 1;
+    if (end - p != 8 || memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1'))
+        return -1;
+    req->minor = p[7] - '0';
+    return 0;
+}
+
+static int parse_header(struct http_view line, struct http_header *h)
+{
+    const char *colon = memchr(line.p, ':', line.len);
+    const char *v, *end = line.p + line.len;
+
+    // no name, or whitespace before the colon (forbidden: smuggling risk)
+    if (colon == NULL || colon == line.p || colon[-1] == ' ' || colon[-1] == '\t')
+        return -1;
+    h->name = (struct http_view){line.p, colon - line.p};
+    for (v = colon + 1; v < end && (*v == ' ' || *v == '\t'); v++)
+        ;
+    while (end > v && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    h->value = (struct http_view){v, end - v};
+    return 0;
+}
+
+static int parse_length(struct http_view v, uint64_t *out)
+{
+    uint64_t n = 0;
+
+    if (v.len == 0 || v.len > 18)
+        return -1;
+    for (size_t i = 0; i < v.len; i++)
+    {
+        if (v.p[i] < '0' || v.p[i] > '9')
+            return -1;
+        n = n * 10 + (v.p[i] - '0');
+    }
+    *out = n;
+    return 0;
+}
+
+long http_parse_request(const char *buf, size_t len, size_t *scanned, struct http_request *req)
+{
+    const char *p = buf, *end, *hit;
+    size_t from = *scanned > 3 ? *scanned - 3 : 0; // "\r\n\r\n" may straddle the old end
+    struct http_view v;
+    int seen_length = 0;
+
+    // Tolerate the empty lines some clients send between pipelined requests
+    while (p < buf + len && (*p == '\r' || *p == '\n'))
+        p++;
+    if (from < (size_t)(p - buf))
+        from = p - buf;
+    end = NULL;
+    if ((hit = memmem(buf + from, len - from, "\n\r\n", 3)) != NULL)
+        end = hit + 3;
+    // a client using bare LFs; whichever blank line comes first ends the headers
+    if ((hit = memmem(buf + from, (end ? (size_t)(end - buf) : len) - from, "\n\n", 2)) != NULL)
+        end = hit + 2;
+    if (end == NULL)
+    {
+        *scanned = len;
+        return 0;
+    }
+
+    memset(req, 0, offsetof(struct http_request, headers));
+    if (parse_request_line(next_line(&p, end), req) < 0)
+        return -1;
+    req->keep_alive = req->minor == 1;
+    while ((v = next_line(&p, end)).len > 0)
+    {
+        struct http_header *h;
+
+        if (req->nheaders == HTTP_MAX_HEADERS)
+            return -1;
+        h = &req->headers[req->nheaders++];
+        if (parse_header(v, h) < 0)
+            return -1;
+        if (http_view_eq(h->name, "Content-Length"))
+        {
+            uint64_t n;
+            if (parse_length(h->value, &n) < 0 || (seen_length && n != req->content_length))
+                return -1;
+            req->content_length = n;
+            seen_length = 1;
+        }
+        else if (http_view_eq(h->name, "Transfer-Encoding"))
+            req->chunked = list_has(h->value, "chunked");
+        else if (http_view_eq(h->name, "Connection"))
+        {
+            if (list_has(h->value, "close"))
+                req->keep_alive = 0;
+            else if (list_has(h->value, "keep-alive"))
+                req->keep_alive = 1;
+        }
+    }
+    if (req->chunked && seen_length)
+        return -1; // both framings at once: refuse rather than guess
+    return end - buf;
+}
@@ -0,0 +1,53 @@
+// Incremental, zero-copy HTTP/1.x request parser.
+//
+// The parser never copies or allocates: the method, target and header names and values
+// it returns are views into the caller's receive buffer, valid until the caller moves
+// or reuses those bytes. Feed it the buffer after every read; it only searches the
+// bytes that are new since the last call for the end of the header block, and parses
+// the request lines once that end has arrived, so a request that trickles in a few
+// bytes at a time is still scanned once.
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 32
+
+struct http_view
+{
+    const char *p;
+    size_t len;
+};
+
+struct http_header
+{
+    struct http_view name;
+    struct http_view value;
+};
+
+struct http_request
+{
+    struct http_view method;
+    struct http_view target;
+    int minor;                  // 1 for HTTP/1.1, 0 for HTTP/1.0
+    int keep_alive;             // from the version and any Connection header
+    int chunked;                // Transfer-Encoding: chunked
+    uint64_t content_length;    // 0 when there is no body
+    int nheaders;
+    struct http_header headers[HTTP_MAX_HEADERS];
+};
+
+// Parse the request at the start of buf[0, len). *scanned is how much of buf earlier
+// calls have already searched; set it to 0 for each new request. Returns the length
+// of the request line and headers including the blank line that ends them, 0 if that
+// blank line has not arrived yet, or -1 if the request is malformed.
+long http_parse_request(const char *buf, size_t len, size_t *scanned, struct http_request *req);
+
+// Does view v equal the NUL-terminated s, ignoring ASCII case?
+int http_view_eq(struct http_view v, const char *s);
+
+// The value of the first header named name (case-insensitive), or a NULL view
+struct http_view http_header_get(const struct http_request *req, const char *name);
+
+#endif
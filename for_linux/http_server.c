@@ -0,0 +1,558 @@
+// HTTP/1.1 server on the edge-triggered epoll reactor (event_loop.c).
+//
+// Connections are kept alive and requests may be pipelined: every complete request
+// already received is answered before anything is written, so a burst of pipelined
+// requests costs one read and one sendmsg(). Requests are parsed in place
+// (http.c): the receive buffer is one pool block (buf_pool.c) that an idle connection
+// gives back. "/" answers with the server's welcome banner; with -d, "/<name>" serves
+// that file from the directory with sendfile(), after the headers have gone out.
+// Build: gcc -O2 -o http_server http_server.c http.c event_loop.c timer_wheel.c mpsc_ring.c net_util.c buf_pool.c conn_table.c -lpthread
+//
+// Usage: http_server [-p port] [-c loops] [-d directory] [-k keepalive_secs]
+//   -c N  N event loops (0 = one per CPU), each with its own SO_REUSEPORT listener
+//   -k N  close keep-alive connections idle for N seconds (default 60, 0 = never)
+// Try: wrk -t4 -c256 -d10 http://127.0.0.1:8080/
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "event_loop.h"
+#include "net_util.h"
+#include "buf_pool.h"
+#include "conn_table.h"
+#include "http.h"
+
+#define TRUE 1
+#define FALSE 0
+#define PORT 8080
+#define OUT_HIGH_WATER (256 * 1024) // stop answering pipelined requests until this is sent
+#define MAX_IOV 64
+#define BANNER "Welcome to the server\r\n"
+
+struct loop;
+
+struct hconn
+{
+    int fd;
+    struct loop *loop;
+    uint32_t events;
+    int closing;           // close once everything queued has been sent
+    struct buf_block *rx;  // received bytes not yet consumed, NULL while there are none
+    size_t scanned;        // bytes of the pending request the parser has searched
+    uint64_t discard;      // request body bytes still to skip
+    struct buf_chain out;  // response headers and in-memory bodies
+    int file;              // body to sendfile() once out is flushed, -1 if none
+    off_t file_off;
+    uint64_t file_left;
+    uint64_t last_active;  // loop clock (ms)
+    struct timer idle;
+};
+
+struct loop
+{
+    int id;
+    int listener;
+    struct event_loop *loop;
+    struct conn_table *conns;
+    pthread_t thread;
+    time_t date_sec;       // second the cached Date header was formatted for
+    char date[64];
+} __attribute__((aligned(64)));
+
+static int port = PORT;
+static int nloops = 1;
+static struct loop *loops;
+static int rootfd = -1;          // -d directory, -1 = no files
+static uint64_t keepalive_ms = 60000;
+
+static void close_conn(struct hconn *c)
+{
+    struct loop *l = c->loop;
+    int fd = c->fd;
+
+    if (c->rx != NULL)
+        buf_block_free(c->rx);
+    if (c->file >= 0)
+        close(c->file);
+    buf_chain_clear(&c->out);
+    event_loop_timer_del(l->loop, &c->idle);
+    event_loop_del(l->loop, fd);
+    conn_table_remove(l->conns, fd);
+    close(fd);
+}
+
+// Date header value, formatted at most once a second per loop
+static const char *http_date(struct loop *l)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+
+    if (now != l->date_sec)
+    {
+        gmtime_r(&now, &tm);
+        strftime(l->date, sizeof(l->date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        l->date_sec = now;
+    }
+    return l->date;
+}
+
+static const char *content_type(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+
+    if (dot == NULL)
+        return "application/octet-stream";
+    if (strcmp(dot, ".html") == 0 || strcmp(dot, ".htm") == 0)
+        return "text/html";
+    if (strcmp(dot, ".txt") == 0)
+        return "text/plain";
+    if (strcmp(dot, ".css") == 0)
+        return "text/css";
+    if (strcmp(dot, ".js") == 0)
+        return "application/javascript";
+    if (strcmp(dot, ".json") == 0)
+        return "application/json";
+    if (strcmp(dot, ".png") == 0)
+        return "image/png";
+    if (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0)
+        return "image/jpeg";
+    return "application/octet-stream";
+}
+
+// Queue a status line and headers for a body of len bytes. Returns 0, or -1 when out
+// of buffers.
+static int queue_head(struct hconn *c, const struct http_request *req, const char *status, const char *type,
+                      uint64_t len)
+{
+    char head[512];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %s\r\nServer: socket-in-C\r\nDate: %s\r\nContent-Type: %s\r\n"
+                     "Content-Length: %llu\r\n%s\r\n",
+                     status, http_date(c->loop), type, (unsigned long long)len,
+                     !req->keep_alive ? "Connection: close\r\n"
+                     : req->minor == 0 ? "Connection: keep-alive\r\n" : "");
+
+    return buf_chain_append(&c->out, head, n);
+}
+
+// A response whose body is a string
+static int respond(struct hconn *c, struct http_request *req, const char *status, const char *body)
+{
+    int head_only = http_view_eq(req->method, "HEAD");
+
+    if (queue_head(c, req, status, "text/plain", strlen(body)) < 0 ||
+        (!head_only && buf_chain_append(&c->out, body, strlen(body)) < 0))
+        return -1;
+    if (!req->keep_alive)
+        c->closing = TRUE;
+    return 0;
+}
+
+// A request we could not frame: answer it as HTTP/1.1 and hang up, since where the
+// next request starts is unknown
+static int respond_bad(struct hconn *c, const char *status, const char *body)
+{
+    struct http_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.minor = 1;
+    return respond(c, &req, status, body);
+}
+
+// GET /<name> with -d: headers now, the body by sendfile() once they have been sent
+static int respond_file(struct hconn *c, struct http_request *req)
+{
+    char name[256];
+    struct stat st;
+    int fd;
+
+    if (req->target.len - 1 >= sizeof(name) || req->target.p[1] == '.' ||
+        memchr(req->target.p + 1, '/', req->target.len - 1) != NULL ||
+        memchr(req->target.p, '?', req->target.len) != NULL)
+        return respond(c, req, "404 Not Found", "Not Found\r\n");
+    memcpy(name, req->target.p + 1, req->target.len - 1);
+    name[req->target.len - 1] = '\0';
+    // O_NOFOLLOW: a symlink in the directory must not serve files from outside it
+    if ((fd = openat(rootfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW)) < 0)
+        return respond(c, req, "404 Not Found", "Not Found\r\n");
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return respond(c, req, "404 Not Found", "Not Found\r\n");
+    }
+    if (queue_head(c, req, "200 OK", content_type(name), st.st_size) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (http_view_eq(req->method, "HEAD") || st.st_size == 0)
+        close(fd);
+    else
+    {
+        c->file = fd;
+        c->file_off = 0;
+        c->file_left = st.st_size;
+    }
+    if (!req->keep_alive)
+        c->closing = TRUE;
+    return 0;
+}
+
+static int route(struct hconn *c, struct http_request *req)
+{
+    if (req->chunked)
+        return respond_bad(c, "501 Not Implemented", "Chunked request bodies are not supported\r\n");
+    c->discard = req->content_length; // we never read request bodies, only skip them
+    if (!http_view_eq(req->method, "GET") && !http_view_eq(req->method, "HEAD"))
+        return respond(c, req, "405 Method Not Allowed", "Method Not Allowed\r\n");
+    if (req->target.len == 1 && req->target.p[0] == '/')
+        return respond(c, req, "200 OK", BANNER);
+    if (rootfd >= 0 && req->target.len > 1 && req->target.p[0] == '/')
+        return respond_file(c, req);
+    return respond(c, req, "404 Not Found", "Not Found\r\n");
+}
+
+// Answer every complete request in c->rx. Stops early at a file response, since
+// later responses must wait for its body, or once OUT_HIGH_WATER bytes are queued.
+// Returns 1 if it stopped early with requests possibly left, 0 if it needs more
+// input, or -1 to close the connection now.
+static int handle_requests(struct hconn *c)
+{
+    struct http_request req;
+
+    while (c->rx != NULL && !c->closing)
+    {
+        struct buf_block *b = c->rx;
+        size_t avail = b->end - b->start;
+
+        if (c->discard > 0)
+        {
+            size_t n = c->discard < avail ? c->discard : avail;
+            b->start += n;
+            c->discard -= n;
+        }
+        else
+        {
+            if (c->file >= 0 || c->out.len >= OUT_HIGH_WATER)
+                return 1;
+            long n = http_parse_request((const char *)b->data + b->start, avail, &c->scanned, &req);
+            if (n < 0)
+                return respond_bad(c, "400 Bad Request", "Bad Request\r\n");
+            if (n == 0)
+            {
+                if (avail == BUF_BLOCK_DATA)
+                    return respond_bad(c, "431 Request Header Fields Too Large", "Headers too large\r\n");
+                return 0;
+            }
+            // req points into b; answer it before the bytes are consumed
+            if (route(c, &req) < 0)
+                return -1;
+            b->start += n;
+            c->scanned = 0;
+        }
+        if (b->start == b->end)
+        {
+            buf_block_free(b); // idle connections hold no receive buffer
+            c->rx = NULL;
+        }
+    }
+    return 0;
+}
+
+// Read into c->rx, moving a partial request to the front of the block when it has
+// reached the end. Returns the byte count, 0 on EOF, or -1 with errno set.
+static ssize_t read_more(struct hconn *c)
+{
+    struct buf_block *b = c->rx;
+    ssize_t n;
+
+    if (b == NULL)
+    {
+        if ((b = c->rx = buf_block_alloc()) == NULL)
+            return -1;
+        b->start = b->end = 0;
+    }
+    else if (b->end == BUF_BLOCK_DATA && b->start > 0)
+    {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+    do
+        n = recv(c->fd, b->data + b->end, BUF_BLOCK_DATA - b->end, 0);
+    while (n < 0 && errno == EINTR);
+    if (n > 0)
+    {
+        b->end += n;
+        c->last_active = event_loop_now(c->loop->loop);
+    }
+    else if (b->start == b->end)
+    {
+        buf_block_free(b);
+        c->rx = NULL;
+    }
+    return n;
+}
+
+// Send the queued headers and bodies, then the pending file. Returns 1 when all of it
+// went out, 0 when the socket is full and -1 on error.
+static int flush(struct hconn *c)
+{
+    struct iovec iov[MAX_IOV];
+    struct msghdr msg;
+
+    while (c->out.len > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = buf_chain_iov(&c->out, iov, MAX_IOV);
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | (c->file >= 0 ? MSG_MORE : 0));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        buf_chain_consume(&c->out, n);
+    }
+    while (c->file_left > 0)
+    {
+        size_t chunk = c->file_left > (1u << 30) ? (1u << 30) : c->file_left;
+        ssize_t n = sendfile(c->fd, c->file, &c->file_off, chunk);
+        if (n < 0)
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        if (n == 0)
+            return -1; // file shrank under us: the response can no longer be framed
+        c->file_left -= n;
+    }
+    if (c->file >= 0)
+    {
+        close(c->file);
+        c->file = -1;
+    }
+    c->last_active = event_loop_now(c->loop->loop);
+    return 1;
+}
+
+// Drive the connection as far as it goes without blocking. Returns the events to wait
+// for next, or 0 to close.
+static uint32_t serve(struct hconn *c)
+{
+    while (TRUE)
+    {
+        int more = handle_requests(c), rc;
+
+        if (more < 0 || (rc = flush(c)) < 0)
+            return 0;
+        if (rc == 0)
+            return EPOLLOUT;
+        if (c->closing)
+            return 0;
+        if (more)
+            continue; // pipelined requests were waiting behind a file or a full queue
+
+        ssize_t n = read_more(c);
+        if (n > 0)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return EPOLLIN;
+        return 0;
+    }
+}
+
+static void on_client(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct loop *l = arg;
+    struct hconn *c = conn_table_get(l->conns, fd);
+
+    if (events & EPOLLERR)
+    {
+        close_conn(c);
+        return;
+    }
+    if ((events = serve(c)) == 0)
+    {
+        close_conn(c);
+        return;
+    }
+    if (events != c->events)
+    {
+        c->events = events;
+        event_loop_mod(loop, fd, events);
+    }
+}
+
+// -k: close connections that have been quiet for keepalive_ms
+static void on_idle(struct timer *t, void *arg)
+{
+    struct hconn *c = arg;
+    struct event_loop *loop = c->loop->loop;
+    uint64_t quiet = event_loop_now(loop) - c->last_active;
+
+    if (quiet < keepalive_ms)
+    {
+        event_loop_timer_add(loop, t, keepalive_ms - quiet);
+        return;
+    }
+    close_conn(c);
+}
+
+static void on_accept(struct event_loop *loop, int listener, uint32_t events, void *arg)
+{
+    struct loop *l = arg;
+    int one = 1;
+    (void)events;
+
+    while (TRUE)
+    {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        struct hconn *c = conn_table_insert(l->conns, fd);
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        // responses are batched by hand; Nagle would only delay the last one
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->fd = fd;
+        c->loop = l;
+        c->file = -1;
+        c->events = EPOLLIN;
+        c->last_active = event_loop_now(loop);
+        buf_chain_init(&c->out);
+        timer_init(&c->idle, on_idle, c);
+        if (keepalive_ms > 0)
+            event_loop_timer_add(loop, &c->idle, keepalive_ms);
+        if (event_loop_add(loop, fd, c->events, on_client, l) < 0)
+        {
+            event_loop_timer_del(loop, &c->idle);
+            conn_table_remove(l->conns, fd);
+            close(fd);
+        }
+    }
+}
+
+static void *loop_main(void *arg)
+{
+    struct loop *l = arg;
+
+    if (event_loop_run(l->loop) < 0)
+    {
+        perror("event_loop_run");
+        exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+static void pin_to_cpu(pthread_t thread, int id)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (ncpu <= 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(id % ncpu, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:d:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            nloops = atoi(optarg);
+            if (nloops <= 0)
+                nloops = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'k':
+            keepalive_ms = (uint64_t)atol(optarg) * 1000;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-c loops] [-d directory] [-k keepalive_secs]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    raise_fd_limit();
+    signal(SIGPIPE, SIG_IGN); // sendfile() to a peer that went away must not kill us
+    if (dir != NULL && (rootfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+    if ((loops = aligned_alloc(64, nloops * sizeof(*loops))) == NULL)
+    {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(loops, 0, nloops * sizeof(*loops));
+    for (int i = 0; i < nloops; i++)
+    {
+        struct loop *l = &loops[i];
+
+        l->id = i;
+        if ((l->loop = event_loop_create()) == NULL || (l->conns = conn_table_create(sizeof(struct hconn))) == NULL)
+        {
+            perror("event_loop_create");
+            exit(EXIT_FAILURE);
+        }
+        if ((l->listener = tcp_listen(port, SOMAXCONN, nloops > 1)) < 0 ||
+            event_loop_add(l->loop, l->listener, EPOLLIN, on_accept, l) < 0)
+        {
+            perror("listen");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("HTTP on port %d with %d loop(s)%s%s\n", port, nloops, dir ? ", serving " : "", dir ? dir : "");
+    fflush(stdout);
+    for (int i = 1; i < nloops; i++)
+    {
+        if (pthread_create(&loops[i].thread, NULL, loop_main, &loops[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        pin_to_cpu(loops[i].thread, i);
+    }
+    if (nloops > 1)
+        pin_to_cpu(pthread_self(), 0);
+    loop_main(&loops[0]);
+    return 0;
+}
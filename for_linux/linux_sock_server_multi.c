@@ -1,3 +1,67 @@
+// Multi-client echo server built on the edge-triggered epoll reactor (event_loop.c).
+// Build: gcc -O2 -o linux_sock_server_multi linux_sock_server_multi.c event_loop.c timer_wheel.c mpsc_ring.c thread_pool.c net_util.c uring_server.c frame.c buf_pool.c conn_table.c metrics.c hdr_hist.c log.c delim.c shm_ring.c -lpthread
+//
+// Usage: linux_sock_server_multi [-p port] [-b epoll|uring] [-w workers] [-q queue] [-c cores] [-f] [-m MB]
+//                                [-u batch] [-i idle_secs] [-D delay_ms] [-a workers]
+//                                [-M port|/unix/path] [-L level] [-l nl|nul] [-B backlog]
+//                                [-C max_conns] [-O delay|shed] [-R path [-U listeners|all]]
+//                                [-x path] [-X path]
+//   -b    I/O backend. uring uses multishot accept/recv with provided buffers and linked
+//         sends (uring_server.c); it falls back to epoll when the kernel lacks support
+//   -w N  hand readable clients to a pool of N worker threads (0 = one per CPU)
+//   -q N  bound the pool's task queue to N entries
+//   -c N  shared-nothing mode: N event loops (0 = one per CPU), each pinned to a CPU
+//         with its own SO_REUSEPORT listener and client table (conn_table.c)
+//   -a N  one acceptor loop hands new sockets to N worker loops (0 = one per CPU)
+//         through their lock-free message queues (event_loop_post)
+//   -M A  export metrics (metrics.h) in Prometheus text format on 127.0.0.1:A, or on the
+//         Unix socket A if it is a path: curl http://127.0.0.1:A/metrics
+//   -f    framed protocol (frame.h): every FRAME_ECHO message is answered with a
+//         FRAME_ECHO_REPLY carrying the same id and payload, instead of a raw byte echo
+//   -l D  delimited protocol: messages end in a newline (nl) or a NUL byte (nul) and
+//         each one is echoed once it is complete; the delimiters are found with a
+//         vectorised scan (delim.c)
+//   -m N  cap connection buffers (buf_pool.c) at N MB; a client that needs a buffer
+//         beyond that is disconnected
+//   -u N  also echo UDP datagrams on the same port, N per recvmmsg()/sendmmsg() call
+//         (at most 64). -u 1 uses one recvfrom()/sendto() per datagram as a baseline
+//   -i N  close connections that have neither sent nor received anything for N seconds
+//   -D N  hold every reply back for N ms before sending it (on a timer, no thread waits)
+//   -L L  log level: debug, info (default), warn, error or off. Log records are queued
+//         per thread and written by a background thread (log.c); debug logs every
+//         connection
+//   -B N  listen backlog (default SOMAXCONN, which the kernel caps at somaxconn)
+//   -C N  admission control: take on no more than N connections at once. New
+//         connections are also held off while the worker pool's queue is 3/4 full or
+//         the -m buffer budget is 90% used
+//   -O P  what to do when overloaded: delay (default) leaves new connections in the
+//         listen backlog and retries every 10 ms; shed accepts and resets them at once
+//         so clients fail fast instead of timing out
+// Each loop accepts at most 64 connections per wakeup before serving its clients
+// again, so a connection storm cannot starve the connections already open. A spare
+// fd is kept per loop for EMFILE: it is closed to accept and reset the connection at
+// the head of the backlog, rather than leave the listener readable with nothing
+// able to drain it.
+//   -R P  hot restart: accept successors on the Unix socket P. A new process started
+//         with the same -R P and -U takes over without refusing a single connection:
+//         it receives the listening (and UDP) sockets over P with SCM_RIGHTS, and with
+//         -U all also every idle connection, i.e. one with nothing buffered. The old
+//         process then stops accepting, finishes the connections it kept and exits once
+//         they are gone, or after 60 s. The number of listening loops follows the old
+//         process. Deploy with: linux_sock_server_multi -R /run/echo.sock -U all ... &
+//   -x P  also accept clients on the Unix stream socket P, served exactly like TCP ones
+//         (same protocol, limits and options) without the TCP/IP stack
+//   -X P  shared-memory clients (shm_ring.c): a client connects to the Unix socket P and
+//         passes a memfd holding a pair of rings and two eventfds; every FRAME_ECHO
+//         frame it puts in its ring is answered in the other, with no syscall at all
+//         while both sides are busy. Served on loop 0, whatever -c/-a/-w say.
+// The -x and -X sockets are not handed over by -R: the successor binds the paths
+// again, and the old process serves what is still queued on them before it closes its
+// own.
+// kill -USR1 <pid> prints the pool's queue depth and worker utilisation, or the
+// per-loop connection counts in -c mode, or the io_uring syscall counters.
+// kill -USR2 <pid> toggles debug logging on and off.
+#define _GNU_SOURCE // accept4, recvmmsg, sendmmsg
 // Required Libraries
 #include <stdio.h>
 #include <string.h> //strlen
@@ -7,168 +71,1859 @@
 #include <arpa/inet.h> //close
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/signalfd.h>
 #include <netinet/in.h>
-#include <sys/time.h> //FD_SET, FD_ISSET, FD_ZERO macros
-#include <pthread.h>  // for threading, link with lpthread
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h> // cpu_set_t
+#include <stdint.h>
+#include <limits.h> // LONG_MAX
+#include <time.h>
+#include <fcntl.h> // open
+#include <poll.h>
+
+#include "event_loop.h"
+#include "thread_pool.h"
+#include "net_util.h"
+#include "uring_server.h"
+#include "frame.h"
+#include "buf_pool.h"
+#include "conn_table.h"
+#include "metrics.h"
+#include "log.h"
+#include "delim.h"
+#include "shm_ring.h"
 
 #define TRUE 1
 #define FALSE 0
 #define PORT 8888
-#define MAX_CLIENTS 100
+#define OUT_HIGH_WATER (256 * 1024) // stop reading from a client with this much unsent output
+#define MAX_IOV 64 // blocks gathered per sendmsg()
+#define MAX_FRAME_PAYLOAD (BUF_BLOCK_DATA - FRAME_HDR_LEN) // a whole frame must fit in one block
+#define MAX_DELIMITED (64 * 1024) // -l: longest message we wait for the end of
+#define ACCEPT_BATCH 64    // connections accepted per wakeup before clients get a turn
+#define ADMIT_RETRY_MS 10  // -O delay: look at the load again this often while overloaded
+#define DRAIN_CHECK_MS 100 // -R: how often a replaced process looks for its last client
+#define DRAIN_TIMEOUT_MS (60 * 1000) // -R: then closes whatever is still open
+#define RESTART_MAGIC 0x48525354
+#define UDP_MAX_BATCH 64   // datagrams per recvmmsg()/sendmmsg()
+#define UDP_MAX_DGRAM 2048 // longer datagrams are truncated
+#define SHM_BATCH 256      // -X: frames answered per wakeup before other clients get a turn
+
+struct core;
+
+// recvmmsg()/sendmmsg() state, set up once per loop and reused for every batch: the
+// same headers that received a batch send it straight back
+struct udp_batch
+{
+    struct mmsghdr msgs[UDP_MAX_BATCH];
+    struct iovec iov[UDP_MAX_BATCH];
+    struct sockaddr_in addr[UDP_MAX_BATCH];
+    char buf[UDP_MAX_BATCH][UDP_MAX_DGRAM];
+};
+
+// State kept for every connected client
+struct client
+{
+    int fd;
+    conn_handle handle;     // names this client in posts from pool workers
+    struct core *core;      // loop that owns this client
+    uint32_t events;        // interest set currently registered with the loop (pool: wanted next)
+    int closing;            // pool mode: a worker is done with it, the loop should close it
+    int reply_due;          // -D: the reply timer has fired, send what is queued
+    uint64_t last_active;   // loop clock (ms) of the last byte received or sent
+    uint64_t bytes_in;      // received over the connection's lifetime
+    uint64_t bytes_out;     // sent over the connection's lifetime
+    uint64_t msgs;          // framed and delimited modes: messages received
+    struct timer idle;      // -i: reaps the client once it has been quiet long enough
+    struct timer reply;     // -D: holds queued replies back
+    struct buf_chain in;    // framed and delimited modes: bytes of not yet complete messages
+    struct buf_chain out;   // output queue: bytes received but not yet echoed back
+};
+
+// One event loop and everything it owns. In -c mode there is one per CPU and they
+// share nothing: no field here is written by another thread (pool workers aside).
+struct core
+{
+    int id;
+    int listener;
+    int unix_listener;           // -x, loop 0 only, -1 if none
+    int sigfd;                   // signalfd handed to the uring backend, -1 if none
+    struct event_loop *loop;
+    pthread_t thread;
+    struct conn_table *clients;  // struct client by fd, only used by this loop
+    long nclients;               // live connections, readable from any thread
+    long accepted;
+    long shed;                   // -a: connections closed because every worker queue was full
+    long refused;                // closed on accept: overload with -O shed, or EMFILE
+    long deferred;               // times accepting was paused for overload
+    int overloaded;              // admission control currently holding off new connections
+    int reserve_fd;              // spare fd given up to accept through EMFILE, -1 if none
+    struct timer accept_retry;   // resumes accepting after a full batch or a pause
+    int udp;                     // UDP socket, -1 without -u
+    struct udp_batch *batch;
+    long udp_in;                 // datagrams received
+    long udp_out;                // datagrams echoed (the rest were dropped on a full socket buffer)
+} __attribute__((aligned(64))); // own cache line, so loops never false-share counters
+
+// Worker pool, NULL when every client is served on the reactor thread
+static struct thread_pool *pool = NULL;
+
+static int port = PORT;
+static struct core *cores;
+static int ncores = 1;
+static int handoff = FALSE; // -a: cores[0] only accepts, cores[1..] serve
+static int use_uring = FALSE;
+static int framed = FALSE;
+static int delim = -1;    // -l: message delimiter, -1 = raw byte echo
+static int udp_batch = 0; // datagrams per syscall, 0 = no UDP
+static uint64_t idle_ms = 0;     // -i, 0 = never reap
+static uint64_t reply_delay = 0; // -D, in ms
+static int metrics_on = FALSE;   // -M: also time every readiness event
+static int backlog = SOMAXCONN;  // -B
+static long max_clients = 0;     // -C, 0 = no limit
+static int shed_overload = FALSE; // -O shed
+static enum log_level base_level = LOG_INFO; // -L, restored when SIGUSR2 turns debug off
+static const char *restart_path = NULL; // -R
+static int take_over = 0;               // -U: 0, or TAKE_LISTENERS / TAKE_ALL
+static const char *unix_path = NULL;    // -x
+static const char *shm_path = NULL;     // -X
+static int shm_listener = -1;           // -X: where shared-memory clients set up, on loop 0
+
+// -X: one shared-memory client, served on loop 0. ctl is the Unix socket the channel
+// was set up over; the client keeps it open for as long as it uses the channel, so
+// its hang-up there is how we learn that it has gone.
+struct shm_client
+{
+    struct shm_channel ch;
+    int ctl;
+    int attached;          // the client has sent the setup message, ch is live
+    struct core *core;
+    struct timer more;     // resumes a client cut short by SHM_BATCH
+};
+
+enum
+{
+    TAKE_LISTENERS = 1,
+    TAKE_ALL
+};
+
+// -R: messages on the restart socket (SOCK_SEQPACKET, so each send is one record,
+// even from several loops at once)
+enum restart_type
+{
+    RESTART_TAKEOVER = 1, // new -> old, flags = RESTART_WANT_CONNS or 0
+    RESTART_LISTENERS,    // old -> new, with ntcp listeners then nudp UDP sockets
+    RESTART_READY,        // new -> old: set up, stop accepting and hand over
+    RESTART_CONNS,        // old -> new, with idle connections
+    RESTART_DONE          // old -> new, once per old loop when it has handed over
+};
 
-// Function to handle client connection
-void *handle_client(void *arg)
+#define RESTART_WANT_CONNS 1
+
+struct restart_msg
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t ntcp;
+    uint32_t nudp;
+    uint32_t nloops; // LISTENERS: DONE messages to expect
+};
+
+// -R: handshake state. The socket and the fields below are only touched on loop 0,
+// except peer and want_conns, which the other loops read once the handover starts.
+static struct
+{
+    int listener;          // where successors connect, -1 if not (yet) listening
+    int peer;              // the successor (old side) or predecessor (new side), -1 if none
+    int handing_over;      // old side: READY received, the loops are handing over
+    int want_conns;
+    int inherited_tcp[FD_PASS_MAX];
+    int inherited_udp[FD_PASS_MAX];
+    int ntcp, nudp;        // new side: sockets received from the predecessor
+    int old_loops, loops_done;
+    unsigned next_core;    // new side: round robin for handed over connections
+    long passed;           // connections handed over / received
+    uint64_t drain_deadline;
+    struct timer drain;
+} restart = {.listener = -1, .peer = -1};
+
+// Runs on the loop's thread only, which is the one thread that touches its table
+static void close_client(struct client *c)
+{
+    struct core *core = c->core;
+    int fd = c->fd;
+
+    buf_chain_clear(&c->in);
+    buf_chain_clear(&c->out);
+    event_loop_timer_del(core->loop, &c->idle);
+    event_loop_timer_del(core->loop, &c->reply);
+    event_loop_del(core->loop, fd);
+    conn_table_remove(core->clients, fd);
+    close(fd);
+    __atomic_sub_fetch(&core->nclients, 1, __ATOMIC_RELAXED);
+    metrics_add(M_CLOSED, 1);
+    metrics_record(M_CONN_BYTES_IN, c->bytes_in);
+    metrics_record(M_CONN_BYTES_OUT, c->bytes_out);
+    if (framed || delim >= 0)
+        metrics_record(M_CONN_MSGS, c->msgs);
+}
+
+// Send whatever is queued in c->out, gathering up to MAX_IOV blocks per sendmsg().
+// Returns 1 when everything went out, 0 when the socket buffer is full (wait for
+// EPOLLOUT) and -1 on error.
+static int flush_client(struct client *c)
 {
-    int new_socket = *(int *)arg;
-    char buffer[1024];
-    int len;
+    struct iovec iov[MAX_IOV];
+    struct msghdr msg;
 
-    while ((len = recv(new_socket, buffer, sizeof(buffer), 0)) > 0)
+    while (c->out.len > 0)
     {
-        buffer[len] = '\0';
-        send(new_socket, buffer, strlen(buffer), 0);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = buf_chain_iov(&c->out, iov, MAX_IOV);
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        buf_chain_consume(&c->out, n);
+        c->bytes_out += n;
+        metrics_add(M_BYTES_OUT, n);
+        __atomic_store_n(&c->last_active, event_loop_now(c->core->loop), __ATOMIC_RELAXED);
     }
+    return 1;
+}
 
-    close(new_socket);
+// Flush the output queue, or with -D hold it back until the reply timer fires. Returns
+// what flush_client does, or 2 while the replies are being held back.
+static int send_replies(struct client *c)
+{
+    int rc;
 
-    return NULL;
+    if (reply_delay == 0)
+        return flush_client(c);
+    if (c->out.len == 0)
+        return 1;
+    if (!c->reply_due)
+    {
+        if (!timer_pending(&c->reply))
+            event_loop_timer_add(c->core->loop, &c->reply, reply_delay);
+        return 2;
+    }
+    if ((rc = flush_client(c)) == 1)
+        c->reply_due = FALSE;
+    return rc;
 }
 
-int main(int argc, char *argv[])
+// Events to wait for after a flush that returned rc. Reading stays on until the output
+// queue passes OUT_HIGH_WATER, so a slow reader only ever costs us that much memory
+// and never blocks the thread.
+static uint32_t next_events(struct client *c, int rc)
+{
+    if (rc == 1 || rc == 2)
+        return EPOLLIN; // held back replies are sent by the reply timer, not EPOLLOUT
+    return c->out.len >= OUT_HIGH_WATER ? EPOLLOUT : EPOLLIN | EPOLLOUT;
+}
+
+// Read what the socket has into the tail of chain. Returns the byte count, 0 on EOF or
+// error, -1 with errno = EAGAIN once drained, or -1 with ENOMEM when out of buffers.
+static ssize_t read_client(struct client *c, struct buf_chain *chain)
 {
-    int opt = TRUE;
-    int master_socket, addrlen, new_socket, client_socket[MAX_CLIENTS], activity, i, valread, sd;
-    int max_sd;
-    struct sockaddr_in address;
+    size_t avail;
+    unsigned char *p = buf_chain_reserve(chain, &avail);
 
-    char buffer[1025]; // data buffer of 1K
+    if (p == NULL)
+        return -1;
+    while (TRUE)
+    {
+        ssize_t len = recv(c->fd, p, avail, 0);
+        if (len > 0)
+        {
+            buf_chain_commit(chain, len);
+            c->bytes_in += len;
+            metrics_add(M_BYTES_IN, len);
+            __atomic_store_n(&c->last_active, event_loop_now(c->core->loop), __ATOMIC_RELAXED);
+        }
+        else if (len < 0 && errno == EINTR)
+            continue;
+        else
+            buf_chain_consume(chain, 0); // hand back the block if nothing landed in it
+        return len;
+    }
+}
 
-    // set of socket descriptors
-    fd_set readfds;
+// Framed mode: answer every complete frame in c->in, queueing the replies on c->out.
+// Everything readable is consumed before a single flush, so a burst of small messages
+// costs one sendmsg(). Frames may arrive split across reads and blocks in any way; the
+// unfinished tail stays in c->in.
+static uint32_t framed_client(struct client *c)
+{
+    int drained = FALSE, rc;
 
-    // initialise all client_socket[] to 0 so not checked
-    for (i = 0; i < MAX_CLIENTS; i++)
+again:
+    while (c->out.len < OUT_HIGH_WATER)
     {
-        client_socket[i] = 0;
+        const unsigned char *p;
+        struct frame f;
+
+        while ((p = buf_chain_pullup(&c->in, FRAME_HDR_LEN)) != NULL)
+        {
+            size_t size = frame_size(p, FRAME_HDR_LEN);
+            if (size > FRAME_HDR_LEN + MAX_FRAME_PAYLOAD)
+                return 0; // frame larger than we accept
+            if ((p = buf_chain_pullup(&c->in, size)) == NULL)
+                break; // wait for the rest of it
+            frame_parse(p, size, MAX_FRAME_PAYLOAD, &f);
+
+            unsigned char hdr[FRAME_HDR_LEN];
+            frame_put_header(hdr, f.len, FRAME_ECHO_REPLY, 0, f.id);
+            if (buf_chain_append(&c->out, hdr, sizeof(hdr)) < 0 ||
+                buf_chain_append(&c->out, f.payload, f.len) < 0)
+                return 0;
+            buf_chain_consume(&c->in, size);
+            c->msgs++;
+            metrics_add(M_MSGS_IN, 1);
+            metrics_add(M_MSGS_OUT, 1);
+        }
+
+        ssize_t len = read_client(c, &c->in);
+        if (len > 0)
+            continue;
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            drained = TRUE;
+            break;
+        }
+        if (len == 0)
+            flush_client(c); // peer half-closed: best effort to deliver what it sent last
+        return 0;
     }
+    if ((rc = send_replies(c)) < 0)
+        return 0;
+    if (rc == 1 && !drained)
+        goto again; // stopped at the high-water mark with input still unread
+    return next_events(c, rc);
+}
 
-    // create a master socket
-    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+// Move the first n bytes of c->in to the end of c->out. When they are all that is
+// queued on either side the chains are swapped instead of copied.
+static int move_messages(struct client *c, size_t n)
+{
+    if (n == c->in.len && c->out.len == 0)
     {
-        perror("socket failed");
-        exit(EXIT_FAILURE);
+        struct buf_chain t = c->out;
+        c->out = c->in;
+        c->in = t;
+        return 0;
     }
+    while (n > 0)
+    {
+        const unsigned char *p;
+        size_t k = buf_chain_peek(&c->in, &p);
 
-    // set master socket to allow multiple connections , this is just a good habit, it will work without this
-    if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0)
+        if (k > n)
+            k = n;
+        if (buf_chain_append(&c->out, p, k) < 0)
+            return -1;
+        buf_chain_consume(&c->in, k);
+        n -= k;
+    }
+    return 0;
+}
+
+// Delimited mode: echo every complete message, delimiter included, and keep an
+// unfinished one in c->in until its delimiter arrives. Only the bytes each read brings
+// are scanned, so a message that trickles in is never rescanned from its start, and a
+// burst of small messages costs one vectorised pass rather than a search per message.
+static uint32_t delimited_client(struct client *c)
+{
+    int drained = FALSE, rc;
+    uint32_t pos[64];
+
+again:
+    while (c->out.len < OUT_HIGH_WATER)
     {
-        perror("setsockopt");
-        exit(EXIT_FAILURE);
+        ssize_t len = read_client(c, &c->in);
+        if (len > 0)
+        {
+            // the new bytes are the end of the tail block
+            const unsigned char *p = c->in.tail->data + c->in.tail->end - len;
+            size_t off = 0, n, msgs = 0;
+
+            while ((n = delim_scan(p + off, len - off, (unsigned char)delim, pos, 64)) > 0)
+            {
+                off += pos[n - 1] + 1;
+                msgs += n;
+                if (n < 64)
+                    break;
+            }
+            if (msgs > 0)
+            {
+                if (move_messages(c, c->in.len - len + off) < 0)
+                    return 0;
+                c->msgs += msgs;
+                metrics_add(M_MSGS_IN, msgs);
+                metrics_add(M_MSGS_OUT, msgs);
+            }
+            if (c->in.len > MAX_DELIMITED)
+                return 0; // no delimiter in sight
+            continue;
+        }
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            drained = TRUE;
+            break;
+        }
+        if (len == 0)
+            flush_client(c); // peer half-closed: best effort to deliver what it sent last
+        return 0;
     }
+    if ((rc = send_replies(c)) < 0)
+        return 0;
+    if (rc == 1 && !drained)
+        goto again; // stopped at the high-water mark with input still unread
+    return next_events(c, rc);
+}
+
+// Echo everything that can be read without blocking. Returns the events to wait for
+// next or 0 to close the client.
+static uint32_t echo_client(struct client *c)
+{
+    int drained = FALSE, rc;
 
-    // type of socket created
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    if (framed)
+        return framed_client(c);
+    if (delim >= 0)
+        return delimited_client(c);
 
-    // bind the socket to localhost port 8888
-    if (bind(master_socket, (struct sockaddr *)&address, sizeof(address)) < 0)
+again:
+    // Edge-triggered: keep reading until the kernel says EAGAIN or the output queue is
+    // full. Data is received straight into the output chain and sent from there.
+    while (c->out.len < OUT_HIGH_WATER)
     {
-        perror("bind failed");
-        exit(EXIT_FAILURE);
+        ssize_t len = read_client(c, &c->out);
+        if (len > 0)
+            continue;
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            drained = TRUE;
+            break;
+        }
+        if (len == 0)
+            flush_client(c); // peer half-closed: best effort to deliver what it sent last
+        return 0; // 0 = orderly shutdown, otherwise a real error or no buffers left
     }
-    printf("Listener on port %d \n", PORT);
+    if ((rc = send_replies(c)) < 0)
+        return 0;
+    if (rc == 1 && !drained)
+        goto again; // stopped at the high-water mark with input still unread
+    return next_events(c, rc);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// echo_client, timed into the service-time histogram when metrics are exported
+static uint32_t timed_echo(struct client *c)
+{
+    uint64_t start;
+    uint32_t events;
+
+    if (!metrics_on)
+        return echo_client(c);
+    start = now_ns();
+    events = echo_client(c);
+    metrics_record(M_SERVICE_NS, now_ns() - start);
+    return events;
+}
+
+// Posted by a pool worker that is done with the client named by val: re-arm it, or
+// close it. The handle resolves to NULL if the client was closed after it was queued.
+static void client_done(void *arg, intptr_t val)
+{
+    struct core *core = arg;
+    struct client *c = conn_table_resolve(core->clients, (conn_handle)val);
 
-    // try to specify maximum of 3 pending connections for the master socket
-    if (listen(master_socket, 3) < 0)
+    if (c == NULL)
+        return;
+    if (c->closing)
+        close_client(c);
+    else
+        event_loop_mod(core->loop, c->fd, c->events | EPOLLONESHOT);
+}
+
+// Worker task. The connection is registered with EPOLLONESHOT, so while this runs no
+// other thread can be handed the same fd; posting it back to the loop ends ownership.
+static void handle_client(void *arg)
+{
+    struct client *c = arg;
+    struct core *core = c->core;
+    uint32_t events = timed_echo(c);
+
+    if (events == 0)
     {
-        perror("listen");
-        exit(EXIT_FAILURE);
+        c->closing = TRUE;
+        shutdown(c->fd, SHUT_RDWR);
+        events = EPOLLIN;
     }
+    c->events = events;
+    // Loop queue full: re-arm from here instead, the socket is still ours. A closing
+    // one then reports EPOLLHUP at once and on_client closes it.
+    if (event_loop_post(core->loop, client_done, core, (intptr_t)c->handle) < 0)
+        event_loop_mod(core->loop, c->fd, events | EPOLLONESHOT);
+}
 
-    // accept the incoming connection
-    addrlen = sizeof(address);
-    puts("Waiting for connections ...");
+// Serve c on the loop's thread and register the events it waits for next
+static void serve_client(struct client *c)
+{
+    uint32_t events = timed_echo(c);
 
-    while (TRUE)
+    if (events == 0)
+    {
+        close_client(c);
+        return;
+    }
+    if (events != c->events)
     {
-        // Clear the socket set using FD_ZERO macro. It initializes the file descriptor set to have zero bits for all file descriptors.
-        FD_ZERO(&readfds);
+        c->events = events;
+        event_loop_mod(c->core->loop, c->fd, events);
+    }
+}
 
-        // Add master socket to set using FD_SET macro. It includes the file descriptor in the set.
-        FD_SET(master_socket, &readfds);
-        max_sd = master_socket; // Initialize max_sd with master_socket
+// Readiness callback for a client socket
+static void on_client(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct core *core = arg;
+    struct client *c = conn_table_get(core->clients, fd);
+    (void)loop;
 
-        // Add child sockets to set
-        for (i = 0; i < MAX_CLIENTS; i++)
-        {
-            // Socket descriptor
-            sd = client_socket[i]; // Assigning client_socket[i] to sd
+    if (c->closing)
+    {
+        close_client(c);
+        return;
+    }
+    if (pool != NULL)
+    {
+        // Queue full: run it here rather than drop the only wakeup we will get
+        if (thread_pool_submit(pool, handle_client, c) < 0)
+            handle_client(c);
+        return;
+    }
 
-            // If valid socket descriptor then add to read list
-            if (sd > 0)               // Checking if sd is greater than 0
-                FD_SET(sd, &readfds); // If sd is valid, include it in the file descriptor set
+    if (events & EPOLLERR)
+    {
+        close_client(c);
+        return;
+    }
+
+    serve_client(c);
+}
 
-            // Highest file descriptor number, need it for the select function
-            if (sd > max_sd) // Checking if sd is greater than max_sd
-                max_sd = sd; // If sd is greater, assign it to max_sd
+// -i: close clients that have neither sent nor received anything for idle_ms
+static void on_idle_timer(struct timer *t, void *arg)
+{
+    struct client *c = arg;
+    struct event_loop *loop = c->core->loop;
+    uint64_t quiet = event_loop_now(loop) - __atomic_load_n(&c->last_active, __ATOMIC_RELAXED);
+
+    // Activity does not touch the timer; it is only pushed back once it fires
+    if (quiet < idle_ms)
+    {
+        event_loop_timer_add(loop, t, idle_ms - quiet);
+        return;
+    }
+    // A pool worker may own the client right now: shut it down instead, whoever
+    // handles it next sees EOF and closes it
+    if (pool != NULL)
+        shutdown(c->fd, SHUT_RDWR);
+    else
+        close_client(c);
+}
+
+// -D: the replies queued reply_delay ms ago may go out now
+static void on_reply_timer(struct timer *t, void *arg)
+{
+    struct client *c = arg;
+    (void)t;
+
+    c->reply_due = TRUE;
+    serve_client(c);
+}
+
+// Baseline for -u 1: one syscall per datagram in each direction
+static void udp_echo_single(struct core *core, struct udp_batch *b)
+{
+    while (TRUE)
+    {
+        socklen_t alen = sizeof(b->addr[0]);
+        ssize_t n = recvfrom(core->udp, b->buf[0], UDP_MAX_DGRAM, 0, (struct sockaddr *)&b->addr[0], &alen);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_error("recvfrom: errno %ld", (long)errno);
+            return;
         }
+        __atomic_add_fetch(&core->udp_in, 1, __ATOMIC_RELAXED);
+        metrics_add(M_MSGS_IN, 1);
+        if (sendto(core->udp, b->buf[0], n, 0, (struct sockaddr *)&b->addr[0], alen) == n)
+        {
+            __atomic_add_fetch(&core->udp_out, 1, __ATOMIC_RELAXED);
+            metrics_add(M_MSGS_OUT, 1);
+        }
+    }
+}
 
-        // Wait for an activity on one of the sockets, timeout is 0.1 sec
-        struct timeval timeout;   // Declare struct timeval variable named timeout
-        timeout.tv_sec = 0;       // Set the number of whole seconds
-        timeout.tv_usec = 100000; // Set the number of microseconds. 100000 microseconds is equal to 0.1 seconds
-        // Call select function. It monitors file descriptors to see if they are ready for I/O operations. It returns the total number of ready descriptors in the set.
-        activity = select(max_sd + 1, &readfds, NULL, NULL, &timeout);
+// Readiness callback for the UDP socket: echo datagrams back a batch at a time until
+// the socket is drained. Datagrams that do not fit in the send buffer are dropped;
+// senders on UDP have to cope with loss anyway.
+static void on_udp(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct core *core = arg;
+    struct udp_batch *b = core->batch;
+    (void)loop;
+    (void)events;
 
-        if ((activity < 0) && (errno != EINTR))
+    if (udp_batch == 1)
+    {
+        udp_echo_single(core, b);
+        return;
+    }
+    while (TRUE)
+    {
+        for (int i = 0; i < udp_batch; i++)
         {
-            printf("select error");
+            b->iov[i].iov_len = UDP_MAX_DGRAM;
+            b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
         }
+        int n = recvmmsg(fd, b->msgs, udp_batch, 0, NULL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_error("recvmmsg: errno %ld", (long)errno);
+            return;
+        }
+        // reply with exactly what arrived, to whoever sent it
+        for (int i = 0; i < n; i++)
+            b->iov[i].iov_len = b->msgs[i].msg_len;
 
-        // If something happened on the master socket , then its an incoming connection
-        if (FD_ISSET(master_socket, &readfds))
+        int sent = 0;
+        while (sent < n)
         {
-            if ((new_socket = accept(master_socket, (struct sockaddr *)&address, (socklen_t *)&addrlen)) < 0)
+            int r = sendmmsg(fd, b->msgs + sent, n - sent, 0);
+            if (r < 0)
             {
-                perror("accept");
-                exit(EXIT_FAILURE);
+                if (errno == EINTR)
+                    continue;
+                break;
             }
+            sent += r;
+        }
+        __atomic_add_fetch(&core->udp_in, n, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&core->udp_out, sent, __ATOMIC_RELAXED);
+        metrics_add(M_MSGS_IN, n);
+        metrics_add(M_MSGS_OUT, sent);
+    }
+}
+
+static struct udp_batch *udp_batch_create(void)
+{
+    struct udp_batch *b = malloc(sizeof(*b));
 
-            // inform user of socket number - used in send and receive commands
-            printf("New connection , socket fd is %d , ip is : %s , port : %d\n", new_socket, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+    if (b == NULL)
+        return NULL;
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < UDP_MAX_BATCH; i++)
+    {
+        b->iov[i].iov_base = b->buf[i];
+        b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addr[i];
+    }
+    return b;
+}
+
+// SIGUSR1 and SIGUSR2 arrive through a signalfd: print the worker pool statistics, or
+// toggle debug logging
+static void on_signal(struct event_loop *loop, int sfd, uint32_t events, void *arg)
+{
+    struct signalfd_siginfo si;
+    struct thread_pool_stats st;
+    struct buf_pool_stats bs;
+    (void)loop;
+    (void)events;
+    (void)arg;
+
+    while (read(sfd, &si, sizeof(si)) == sizeof(si))
+    {
+        if (si.ssi_signo == SIGUSR2)
+        {
+            enum log_level level = log_level == LOG_DEBUG ? base_level : LOG_DEBUG;
+            log_set_level(level);
+            if (level == LOG_DEBUG)
+                log_info("debug logging on");
+            else
+                log_info("debug logging off");
+            continue;
+        }
+        for (int i = 0; i < ncores; i++)
+            printf("loop %d: %ld connections, %ld accepted\n", cores[i].id,
+                   __atomic_load_n(&cores[i].nclients, __ATOMIC_RELAXED),
+                   __atomic_load_n(&cores[i].accepted, __ATOMIC_RELAXED));
+        if (handoff)
+            printf("acceptor: %ld connections shed on full worker queues\n",
+                   __atomic_load_n(&cores[0].shed, __ATOMIC_RELAXED));
+        for (int i = 0; i < ncores; i++)
+            if (cores[i].listener >= 0)
+                printf("loop %d: %ld connections refused, accepting paused %ld times for overload\n", cores[i].id,
+                       __atomic_load_n(&cores[i].refused, __ATOMIC_RELAXED),
+                       __atomic_load_n(&cores[i].deferred, __ATOMIC_RELAXED));
+        for (int i = 0; udp_batch > 0 && i < ncores; i++)
+            printf("loop %d: udp %ld datagrams in, %ld echoed\n", cores[i].id,
+                   __atomic_load_n(&cores[i].udp_in, __ATOMIC_RELAXED),
+                   __atomic_load_n(&cores[i].udp_out, __ATOMIC_RELAXED));
+        buf_pool_stats(&bs);
+        printf("buffers: %llu blocks of %d bytes in %llu slabs, %llu on the shared free list, limit %llu\n",
+               (unsigned long long)bs.blocks, BUF_BLOCK_SIZE, (unsigned long long)bs.slabs,
+               (unsigned long long)bs.shared_free, (unsigned long long)bs.limit);
+        fflush(stdout);
+        if (pool == NULL)
+            continue;
+        thread_pool_stats(pool, &st);
+        printf("pool: workers %d busy %d utilisation %.1f%% queue %d/%d (peak %d) submitted %llu rejected %llu completed %llu\n",
+               st.nthreads, st.busy, st.utilisation * 100.0, st.queue_depth, st.queue_capacity, st.queue_peak,
+               (unsigned long long)st.submitted, (unsigned long long)st.rejected, (unsigned long long)st.completed);
+        fflush(stdout);
+    }
+}
+
+// Start serving a freshly accepted socket on core's loop (and thread)
+static void add_client(struct core *core, int new_socket)
+{
+    struct event_loop *loop = core->loop;
+    struct client *c = conn_table_insert(core->clients, new_socket);
+
+    if (c == NULL)
+    {
+        log_error("conn_table_insert: fd %ld, errno %ld", (long)new_socket, (long)errno);
+        close(new_socket);
+        return;
+    }
+    __atomic_add_fetch(&core->accepted, 1, __ATOMIC_RELAXED);
+    metrics_add(M_ACCEPTED, 1);
+    __atomic_add_fetch(&core->nclients, 1, __ATOMIC_RELAXED);
+    c->fd = new_socket;
+    c->handle = conn_table_handle(core->clients, new_socket);
+    c->core = core;
+    c->events = pool ? EPOLLIN | EPOLLONESHOT : EPOLLIN;
+    c->last_active = event_loop_now(loop);
+    timer_init(&c->idle, on_idle_timer, c);
+    timer_init(&c->reply, on_reply_timer, c);
+    if (idle_ms > 0)
+        event_loop_timer_add(loop, &c->idle, idle_ms);
+    buf_chain_init(&c->in);
+    buf_chain_init(&c->out);
+
+    if (event_loop_add(loop, new_socket, c->events, on_client, core) < 0)
+    {
+        log_error("event_loop_add: fd %ld, errno %ld", (long)new_socket, (long)errno);
+        event_loop_timer_del(loop, &c->idle);
+        conn_table_remove(core->clients, new_socket);
+        close(new_socket);
+        __atomic_sub_fetch(&core->nclients, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// -a: posted by the acceptor, runs on the worker loop that is to own the socket
+static void adopt_client(void *arg, intptr_t fd)
+{
+    add_client(arg, (int)fd);
+}
+
+// -a: pass a new socket to the worker loops round-robin. A worker whose queue is full
+// is skipped; if all of them are, the connection is shed rather than stall accepting.
+static void hand_off(int fd)
+{
+    static unsigned next; // only the acceptor thread runs this
+    int nworkers = ncores - 1;
+
+    for (int tries = 0; tries < nworkers; tries++)
+    {
+        struct core *w = &cores[1 + next++ % nworkers];
+        if (event_loop_post(w->loop, adopt_client, w, fd) == 0)
+            return;
+    }
+    __atomic_add_fetch(&cores[0].shed, 1, __ATOMIC_RELAXED);
+    close(fd);
+}
+
+static long live_clients(void)
+{
+    long n = 0;
+
+    for (int i = 0; i < ncores; i++)
+        n += __atomic_load_n(&cores[i].nclients, __ATOMIC_RELAXED);
+    return n;
+}
+
+// Admission control: how many new connections may be taken on now, 0 to hold them
+// off. Looks at the connection count (-C), the worker pool's queue and the buffer
+// budget (-m). The pool and buffer statistics take locks, so this is evaluated once per
+// accept batch rather than per connection; the batch then counts down what it admits.
+static long admission_room(void)
+{
+    struct thread_pool_stats st;
+    struct buf_pool_stats bs;
+
+    if (pool != NULL)
+    {
+        thread_pool_stats(pool, &st);
+        if (st.queue_capacity > 0 && st.queue_depth * 4 >= st.queue_capacity * 3)
+            return 0;
+    }
+    buf_pool_stats(&bs);
+    // blocks not on the shared free list are in use or in some thread's small cache
+    if (bs.limit > 0 && (bs.blocks - bs.shared_free) * 10 >= bs.limit * 9)
+        return 0;
+    if (max_clients == 0)
+        return LONG_MAX;
+    return max_clients > live_clients() ? max_clients - live_clients() : 0;
+}
+
+// Close a connection we will not serve with a reset, so the client learns at once and
+// neither side is left in TIME_WAIT
+static void refuse(struct core *core, int fd)
+{
+    struct linger lg = {1, 0};
+
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(fd);
+    __atomic_add_fetch(&core->refused, 1, __ATOMIC_RELAXED);
+    metrics_add(M_REFUSED, 1);
+}
+
+// EMFILE / ENFILE: give up the spare fd to accept the connection at the head of the
+// backlog and refuse it, then take the spare back. Returns FALSE when there is no spare.
+static int refuse_with_reserve(struct core *core, int master_socket)
+{
+    int fd;
+
+    if (core->reserve_fd < 0)
+        return FALSE;
+    close(core->reserve_fd);
+    if ((fd = accept4(master_socket, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+        refuse(core, fd);
+    core->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return TRUE;
+}
 
-            // add new socket to array of sockets
-            for (i = 0; i < MAX_CLIENTS; i++)
+// Readiness callback for the listening socket: accept pending connections, at most
+// ACCEPT_BATCH at a time. The listener is edge-triggered, so whenever this stops short
+// of EAGAIN it arranges to be called again from the timer wheel.
+static void on_accept(struct event_loop *loop, int master_socket, uint32_t events, void *arg)
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    struct core *core = arg;
+    long room = admission_room();
+    (void)events;
+
+    for (int n = 0; n < ACCEPT_BATCH; n++)
+    {
+        if (room <= 0)
+        {
+            if (!core->overloaded)
             {
-                // if position is empty
-                if (client_socket[i] == 0)
-                {
-                    client_socket[i] = new_socket;
-                    printf("Adding to list of sockets as %d\n", i);
-                    break;
-                }
+                core->overloaded = TRUE;
+                if (shed_overload)
+                    log_warn("loop %ld: overloaded at %ld connections, refusing new ones", (long)core->id,
+                             live_clients());
+                else
+                    log_warn("loop %ld: overloaded at %ld connections, delaying new ones", (long)core->id,
+                             live_clients());
+            }
+            if (!shed_overload)
+            {
+                __atomic_add_fetch(&core->deferred, 1, __ATOMIC_RELAXED);
+                event_loop_timer_add(loop, &core->accept_retry, ADMIT_RETRY_MS);
+                return;
             }
         }
+        else if (core->overloaded)
+        {
+            core->overloaded = FALSE;
+            log_info("loop %ld: accepting connections again", (long)core->id);
+        }
+
+        addrlen = sizeof(address);
+        int new_socket = accept4(master_socket, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if ((errno == EMFILE || errno == ENFILE) && refuse_with_reserve(core, master_socket))
+                continue;
+            // out of memory or fds with no spare left: try again shortly
+            log_error("accept: errno %ld", (long)errno);
+            event_loop_timer_add(loop, &core->accept_retry, ADMIT_RETRY_MS);
+            return;
+        }
+        if (core->overloaded) // -O shed
+        {
+            refuse(core, new_socket);
+            continue;
+        }
+        room--;
+
+        // inform user of socket number - used in send and receive commands
+        if (address.ss_family == AF_INET)
+        {
+            struct sockaddr_in *in = (struct sockaddr_in *)&address;
+            uint32_t ip = ntohl(in->sin_addr.s_addr);
+            log_debug("New connection , socket fd is %ld , ip is : %lu.%lu.%lu.%lu , port : %lu", (long)new_socket,
+                      (long)(ip >> 24), (long)(ip >> 16 & 255), (long)(ip >> 8 & 255), (long)(ip & 255),
+                      (long)ntohs(in->sin_port));
+        }
+        else
+            log_debug("New connection , socket fd is %ld , on the Unix socket", (long)new_socket);
+
+        if (handoff)
+            hand_off(new_socket);
+        else
+            add_client(core, new_socket);
+    }
+    // maybe more waiting, but let this loop's clients have their turn first
+    event_loop_timer_add(loop, &core->accept_retry, 0);
+}
+
+static void on_accept_retry(struct timer *t, void *arg)
+{
+    struct core *core = arg;
+    (void)t;
+
+    if (core->listener >= 0) // not handed over since
+        on_accept(core->loop, core->listener, EPOLLIN, core);
+    if (core->unix_listener >= 0)
+        on_accept(core->loop, core->unix_listener, EPOLLIN, core);
+}
+
+static void shm_client_close(struct shm_client *s)
+{
+    struct event_loop *loop = s->core->loop;
+
+    if (s->attached)
+    {
+        event_loop_del(loop, s->ch.event_fd);
+        __atomic_sub_fetch(&s->core->nclients, 1, __ATOMIC_RELAXED);
+        metrics_add(M_CLOSED, 1);
+    }
+    event_loop_timer_del(loop, &s->more);
+    event_loop_del(loop, s->ctl);
+    close(s->ctl);
+    shm_channel_close(&s->ch);
+    free(s);
+}
+
+// -X: answer up to SHM_BATCH frames from the client's ring in the reply ring. Returns
+// 0 once the client's ring is empty, 1 if the reply ring is full (the client wakes us
+// when it has made room), 2 when the batch ran out, or -1 on a protocol error.
+static int shm_echo(struct shm_client *s)
+{
+    for (int n = 0; n < SHM_BATCH; n++)
+    {
+        const unsigned char *p;
+        unsigned char hdr[FRAME_HDR_LEN];
+        struct frame f;
+        size_t len;
+        int rc;
+
+        if ((rc = shm_recv(&s->ch, &p, &len)) <= 0)
+            return rc;
+        // one ring message is one frame; SHM_MSG_MAX bounds the payload already
+        if (frame_parse(p, len, SHM_MSG_MAX, &f) != (long)len)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        frame_put_header(hdr, f.len, FRAME_ECHO_REPLY, 0, f.id);
+        if (shm_send(&s->ch, hdr, sizeof(hdr), f.payload, f.len) < 0)
+            return errno == EAGAIN ? 1 : -1;
+        shm_consume(&s->ch);
+        metrics_add(M_BYTES_IN, len);
+        metrics_add(M_BYTES_OUT, len);
+        metrics_add(M_MSGS_IN, 1);
+        metrics_add(M_MSGS_OUT, 1);
+    }
+    return 2;
+}
+
+// -X: the client's eventfd fired: it sent frames, or made room for our replies
+static void on_shm_event(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct shm_client *s = arg;
+    int rc;
+    (void)fd;
+    (void)events;
+
+    shm_wake(&s->ch);
+    if ((rc = shm_echo(s)) < 0)
+    {
+        log_warn("shm client %ld: bad ring, errno %ld", (long)s->ctl, (long)errno);
+        shm_client_close(s);
+        return;
+    }
+    shm_notify(&s->ch);
+    // sleep only once the client knows to wake us; if it sent more meanwhile, or the
+    // batch ran out, come back after the other clients have had their turn
+    if (rc == 2 || (rc == 0 && !shm_prepare_sleep(&s->ch)))
+        event_loop_timer_add(loop, &s->more, 0);
+}
+
+static void on_shm_more(struct timer *t, void *arg)
+{
+    struct shm_client *s = arg;
+    (void)t;
 
-        // else its some IO operation on some other socket
-        for (i = 0; i < MAX_CLIENTS; i++)
+    on_shm_event(s->core->loop, s->ch.event_fd, EPOLLIN, s);
+}
+
+// -X: the setup message (SHM_MAGIC with the client's memfd and eventfds), and later
+// the client hanging up
+static void on_shm_ctl(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct shm_client *s = arg;
+    int fds[FD_PASS_MAX], nfds = 0;
+    uint32_t magic;
+    ssize_t n;
+    (void)events;
+
+    if ((n = fd_recv(fd, &magic, sizeof(magic), fds, &nfds)) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (!s->attached && n == sizeof(magic) && magic == SHM_MAGIC && nfds == 3)
+    {
+        if (shm_channel_attach(&s->ch, fds[0], fds[1], fds[2]) < 0 ||
+            event_loop_add(loop, s->ch.event_fd, EPOLLIN, on_shm_event, s) < 0)
         {
-            sd = client_socket[i];
+            log_warn("shm client %ld: setup failed, errno %ld", (long)fd, (long)errno);
+            shm_client_close(s);
+            return;
+        }
+        s->attached = TRUE;
+        metrics_add(M_ACCEPTED, 1);
+        __atomic_add_fetch(&s->core->accepted, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->core->nclients, 1, __ATOMIC_RELAXED);
+        log_debug("New shared-memory client , socket fd is %ld", (long)fd);
+        on_shm_event(loop, s->ch.event_fd, EPOLLIN, s); // it may have sent already
+        return;
+    }
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+    shm_client_close(s); // hung up, or broke the protocol
+}
 
-            if (FD_ISSET(sd, &readfds))
+// -X: a shared-memory client connecting to set up its channel
+static void on_shm_accept(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct core *core = arg;
+    struct shm_client *s;
+    long room = admission_room();
+    int ctl;
+    (void)events;
+
+    while ((ctl = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (room <= 0 || (s = calloc(1, sizeof(*s))) == NULL)
+        {
+            refuse(core, ctl);
+            continue;
+        }
+        room--;
+        s->ctl = ctl;
+        s->core = core;
+        s->ch.memfd = s->ch.event_fd = s->ch.peer_fd = -1;
+        timer_init(&s->more, on_shm_more, s);
+        if (event_loop_add(loop, ctl, EPOLLIN | EPOLLRDHUP, on_shm_ctl, s) < 0)
+        {
+            close(ctl);
+            free(s);
+        }
+    }
+}
+
+// -R, old side: send one message to the successor. Called from any loop; a successor
+// slow to read stalls the sender for at most a second.
+static int restart_send(uint32_t type, const int *fds, int nfds)
+{
+    struct restart_msg m = {.magic = RESTART_MAGIC, .type = type};
+    struct pollfd p = {.fd = restart.peer, .events = POLLOUT};
+
+    while (fd_send(restart.peer, &m, sizeof(m), fds, nfds) < 0)
+        if (errno != EAGAIN || poll(&p, 1, 1000) <= 0)
+            return -1;
+    return 0;
+}
+
+struct pass_batch
+{
+    int fds[FD_PASS_MAX];
+    int n;
+};
+
+static void pass_flush(struct pass_batch *b)
+{
+    if (b->n == 0)
+        return;
+    if (restart_send(RESTART_CONNS, b->fds, b->n) < 0)
+        log_error("hot restart: %ld connections lost, errno %ld", (long)b->n, (long)errno);
+    else
+        __atomic_add_fetch(&restart.passed, b->n, __ATOMIC_RELAXED);
+    for (int i = 0; i < b->n; i++)
+        close(b->fds[i]); // the successor has its own reference now
+    b->n = 0;
+}
+
+// conn_table_foreach callback: hand over c if nothing is buffered for it, which is all
+// the state a connection has here beyond its socket
+static void pass_if_idle(void *obj, int fd, void *arg)
+{
+    struct client *c = obj;
+    struct core *core = c->core;
+    struct pass_batch *b = arg;
+
+    if (c->in.len > 0 || c->out.len > 0 || timer_pending(&c->reply))
+        return;
+    event_loop_timer_del(core->loop, &c->idle);
+    event_loop_del(core->loop, fd);
+    conn_table_remove(core->clients, fd);
+    __atomic_sub_fetch(&core->nclients, 1, __ATOMIC_RELAXED);
+    b->fds[b->n++] = fd;
+    if (b->n == FD_PASS_MAX)
+        pass_flush(b);
+}
+
+// -R, old side: runs on every loop once the successor is ready. The listeners are
+// closed here only; the successor holds its own references, so the kernel keeps
+// queueing connections for it throughout.
+static void restart_stop(void *arg, intptr_t val)
+{
+    struct core *core = arg;
+    struct pass_batch b = {.n = 0};
+    (void)val;
+
+    if (core->listener >= 0)
+    {
+        event_loop_timer_del(core->loop, &core->accept_retry);
+        event_loop_del(core->loop, core->listener);
+        close(core->listener);
+        core->listener = -1;
+    }
+    if (core->unix_listener >= 0)
+    {
+        // the successor listens on the path already: serve what is still queued here
+        int fd;
+        while ((fd = accept4(core->unix_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+            if (handoff)
+                hand_off(fd);
+            else
+                add_client(core, fd);
+        event_loop_del(core->loop, core->unix_listener);
+        close(core->unix_listener);
+        core->unix_listener = -1;
+    }
+    if (core->id == 0 && shm_listener >= 0)
+    {
+        on_shm_accept(core->loop, shm_listener, EPOLLIN, core);
+        event_loop_del(core->loop, shm_listener);
+        close(shm_listener);
+        shm_listener = -1;
+    }
+    if (core->udp >= 0)
+    {
+        event_loop_del(core->loop, core->udp);
+        close(core->udp);
+        core->udp = -1;
+    }
+    if (restart.want_conns && pool == NULL)
+    {
+        conn_table_foreach(core->clients, pass_if_idle, &b);
+        pass_flush(&b);
+    }
+    if (restart_send(RESTART_DONE, NULL, 0) < 0)
+        log_error("hot restart: loop %ld could not report to the successor, errno %ld", (long)core->id, (long)errno);
+}
+
+static void stop_loop(void *arg, intptr_t val)
+{
+    (void)val;
+    event_loop_stop(((struct core *)arg)->loop);
+}
+
+// -R, old side: exit once the connections we kept are gone, or at the deadline
+static void on_drain_timer(struct timer *t, void *arg)
+{
+    struct event_loop *loop = cores[0].loop;
+    long left = live_clients();
+    (void)arg;
+
+    if (left > 0 && event_loop_now(loop) < restart.drain_deadline)
+    {
+        event_loop_timer_add(loop, t, DRAIN_CHECK_MS);
+        return;
+    }
+    log_info("hot restart: handed over %ld connections, exiting with %ld still open",
+             __atomic_load_n(&restart.passed, __ATOMIC_RELAXED), left);
+    for (int i = 1; i < ncores; i++)
+        while (event_loop_post(cores[i].loop, stop_loop, &cores[i], 0) < 0)
+            sched_yield();
+    event_loop_stop(loop);
+}
+
+static void restart_drop_peer(void)
+{
+    event_loop_del(cores[0].loop, restart.peer);
+    close(restart.peer);
+    restart.peer = -1;
+}
+
+// -R, old side: the conversation with a successor
+static void on_restart_old(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct restart_msg m;
+    int fds[FD_PASS_MAX], nfds;
+    ssize_t n;
+    (void)events;
+    (void)arg;
+
+    while ((n = fd_recv(fd, &m, sizeof(m), fds, &nfds)) > 0)
+    {
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]); // a successor never sends any
+        if (n != sizeof(m) || m.magic != RESTART_MAGIC)
+            break;
+        if (m.type == RESTART_TAKEOVER)
+        {
+            struct restart_msg reply = {.magic = RESTART_MAGIC, .type = RESTART_LISTENERS, .nloops = ncores};
+            int socks[FD_PASS_MAX], k = 0;
+
+            restart.want_conns = (m.flags & RESTART_WANT_CONNS) != 0;
+            for (int i = 0; i < ncores && k < FD_PASS_MAX; i++)
+                if (cores[i].listener >= 0)
+                    socks[k++] = cores[i].listener;
+            reply.ntcp = k;
+            for (int i = 0; i < ncores && k < FD_PASS_MAX; i++)
+                if (cores[i].udp >= 0)
+                    socks[k++] = cores[i].udp;
+            reply.nudp = k - reply.ntcp;
+            if (fd_send(fd, &reply, sizeof(reply), socks, k) < 0)
+                break;
+            log_info("hot restart: offered %ld listeners to a successor", (long)reply.ntcp);
+        }
+        else if (m.type == RESTART_READY && !restart.handing_over)
+        {
+            restart.handing_over = TRUE;
+            restart.passed = 0; // counted again, now as handed over
+            log_info("hot restart: successor ready, handing over");
+            event_loop_del(loop, restart.listener);
+            close(restart.listener);
+            restart.listener = -1;
+            for (int i = 1; i < ncores; i++)
+                while (event_loop_post(cores[i].loop, restart_stop, &cores[i], 0) < 0)
+                    sched_yield();
+            restart_stop(&cores[0], 0);
+            restart.drain_deadline = event_loop_now(loop) + DRAIN_TIMEOUT_MS;
+            timer_init(&restart.drain, on_drain_timer, NULL);
+            event_loop_timer_add(loop, &restart.drain, DRAIN_CHECK_MS);
+        }
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    // the successor is gone (or confused). Before READY nothing has changed here and we
+    // carry on; after it, other loops may still be sending, so the socket stays open
+    // until we exit.
+    if (restart.handing_over)
+    {
+        event_loop_del(loop, fd);
+        return;
+    }
+    log_warn("hot restart: successor went away, still serving");
+    restart_drop_peer();
+}
+
+static void on_restart_accept(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    int peer;
+    (void)events;
+    (void)arg;
+
+    while ((peer = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (restart.peer >= 0 || restart.handing_over)
+        {
+            close(peer); // one successor at a time
+            continue;
+        }
+        if (event_loop_add(loop, peer, EPOLLIN, on_restart_old, NULL) < 0)
+        {
+            close(peer);
+            continue;
+        }
+        restart.peer = peer;
+    }
+}
+
+// -R: listen for a successor on loop 0
+static void restart_listen(void)
+{
+    if ((restart.listener = unix_listen(restart_path, SOCK_SEQPACKET, 4)) < 0 ||
+        set_nonblocking(restart.listener) < 0 ||
+        event_loop_add(cores[0].loop, restart.listener, EPOLLIN, on_restart_accept, NULL) < 0)
+    {
+        perror("hot restart socket");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// -U, new side: give a connection the predecessor handed over to one of our loops
+static void adopt_passed(int fd)
+{
+    int first = handoff ? 1 : 0; // -a: loop 0 only accepts
+    struct core *w = &cores[first + restart.next_core++ % (ncores - first)];
+
+    restart.passed++;
+    if (w == &cores[0])
+        add_client(w, fd);
+    else if (event_loop_post(w->loop, adopt_client, w, fd) < 0)
+    {
+        if (handoff)
+        {
+            log_error("hot restart: no room for fd %ld on loop %ld", (long)fd, (long)w->id);
+            close(fd);
+        }
+        else
+            add_client(&cores[0], fd);
+    }
+}
+
+// -U, new side: receive the predecessor's connections until every one of its loops has
+// reported, then become the one a future successor talks to
+static void on_restart_new(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct restart_msg m;
+    int fds[FD_PASS_MAX], nfds;
+    ssize_t n;
+    (void)loop;
+    (void)events;
+    (void)arg;
+
+    while ((n = fd_recv(fd, &m, sizeof(m), fds, &nfds)) > 0)
+    {
+        int conns = n == sizeof(m) && m.magic == RESTART_MAGIC && m.type == RESTART_CONNS;
+
+        for (int i = 0; i < nfds; i++)
+        {
+            if (conns)
+                adopt_passed(fds[i]);
+            else
+                close(fds[i]);
+        }
+        if (n == sizeof(m) && m.magic == RESTART_MAGIC && m.type == RESTART_DONE &&
+            ++restart.loops_done == restart.old_loops)
+            break;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (restart.loops_done < restart.old_loops)
+        log_warn("hot restart: predecessor went away with %ld of %ld loops handed over", (long)restart.loops_done,
+                 (long)restart.old_loops);
+    log_info("hot restart: took over %ld listeners and %ld connections", (long)restart.ntcp, restart.passed);
+    restart_drop_peer();
+    restart_listen();
+}
+
+// -U, new side, before any loop exists: ask the process on restart_path for its
+// sockets. Nothing changes over there until we send READY, so failing here is safe.
+static void restart_take_over(void)
+{
+    struct restart_msg m = {.magic = RESTART_MAGIC, .type = RESTART_TAKEOVER};
+    struct timeval tv = {5, 0};
+    int fds[FD_PASS_MAX], nfds;
+    ssize_t n;
+
+    m.flags = take_over == TAKE_ALL ? RESTART_WANT_CONNS : 0;
+    if ((restart.peer = unix_connect(restart_path, SOCK_SEQPACKET)) < 0 ||
+        setsockopt(restart.peer, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+        fd_send(restart.peer, &m, sizeof(m), NULL, 0) < 0 || (n = fd_recv(restart.peer, &m, sizeof(m), fds, &nfds)) < 0)
+    {
+        perror("hot restart");
+        exit(EXIT_FAILURE);
+    }
+    if (n != sizeof(m) || m.magic != RESTART_MAGIC || m.type != RESTART_LISTENERS || m.ntcp == 0 ||
+        (int)(m.ntcp + m.nudp) != nfds)
+    {
+        fprintf(stderr, "hot restart: unexpected answer from %s\n", restart_path);
+        exit(EXIT_FAILURE);
+    }
+    restart.ntcp = m.ntcp;
+    restart.nudp = m.nudp;
+    memcpy(restart.inherited_tcp, fds, m.ntcp * sizeof(int));
+    memcpy(restart.inherited_udp, fds + m.ntcp, m.nudp * sizeof(int));
+    restart.old_loops = m.nloops;
+    if (handoff && restart.ntcp != 1)
+    {
+        fprintf(stderr, "hot restart: -a needs one listener, the old process has %d\n", restart.ntcp);
+        exit(EXIT_FAILURE);
+    }
+    if (!handoff && ncores != restart.ntcp)
+    {
+        printf("Taking over %d listeners: running %d loops\n", restart.ntcp, restart.ntcp);
+        ncores = restart.ntcp;
+    }
+}
+
+// -U, new side, once the loops are set up on the inherited sockets
+static void restart_ready(void)
+{
+    struct restart_msg m = {.magic = RESTART_MAGIC, .type = RESTART_READY};
+
+    for (int i = 0; i < restart.nudp; i++)
+        if (udp_batch == 0 || i >= ncores)
+            close(restart.inherited_udp[i]); // no use for it
+    if (fd_send(restart.peer, &m, sizeof(m), NULL, 0) < 0 || set_nonblocking(restart.peer) < 0 ||
+        event_loop_add(cores[0].loop, restart.peer, EPOLLIN, on_restart_new, NULL) < 0)
+    {
+        perror("hot restart");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Create a loop with its own listener. Every loop binds the port itself when there are
+// several of them, so the kernel load-balances connections with SO_REUSEPORT.
+// In -a mode only loop 0 listens.
+static void core_init(struct core *core, int id)
+{
+    core->id = id;
+    core->listener = core->unix_listener = core->udp = core->reserve_fd = -1;
+    if ((core->loop = event_loop_create()) == NULL)
+    {
+        perror("event_loop_create");
+        exit(EXIT_FAILURE);
+    }
+    if ((core->clients = conn_table_create(sizeof(struct client))) == NULL)
+    {
+        perror("conn_table_create");
+        exit(EXIT_FAILURE);
+    }
+    if (handoff && id > 0)
+        return;
+    if (id < restart.ntcp)
+        core->listener = restart.inherited_tcp[id];
+    else if ((core->listener = tcp_listen(port, backlog, ncores > 1 && !handoff)) < 0)
+    {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+    core->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    timer_init(&core->accept_retry, on_accept_retry, core);
+    if (event_loop_add(core->loop, core->listener, EPOLLIN, on_accept, core) < 0)
+    {
+        perror("event_loop_add");
+        exit(EXIT_FAILURE);
+    }
+    // same-host clients: -x and -X on loop 0 only
+    if (id == 0 && unix_path != NULL &&
+        ((core->unix_listener = unix_listen(unix_path, SOCK_STREAM, backlog)) < 0 ||
+         set_nonblocking(core->unix_listener) < 0 ||
+         event_loop_add(core->loop, core->unix_listener, EPOLLIN, on_accept, core) < 0))
+    {
+        perror(unix_path);
+        exit(EXIT_FAILURE);
+    }
+    if (id == 0 && shm_path != NULL &&
+        ((shm_listener = unix_listen(shm_path, SOCK_SEQPACKET, backlog)) < 0 || set_nonblocking(shm_listener) < 0 ||
+         event_loop_add(core->loop, shm_listener, EPOLLIN, on_shm_accept, core) < 0))
+    {
+        perror(shm_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (udp_batch == 0)
+        return;
+    if (id < restart.nudp)
+        core->udp = restart.inherited_udp[id];
+    else if ((core->udp = udp_bind(port, ncores > 1 && !handoff)) < 0)
+    {
+        perror("udp");
+        exit(EXIT_FAILURE);
+    }
+    if ((core->batch = udp_batch_create()) == NULL)
+    {
+        perror("udp");
+        exit(EXIT_FAILURE);
+    }
+    if (event_loop_add(core->loop, core->udp, EPOLLIN, on_udp, core) < 0)
+    {
+        perror("event_loop_add");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void *core_main(void *arg)
+{
+    struct core *core = arg;
+
+    if (use_uring)
+    {
+        uring_server_run(core->listener, core->sigfd);
+        perror("uring_server_run");
+        exit(EXIT_FAILURE);
+    }
+    if (event_loop_run(core->loop) < 0)
+    {
+        perror("event_loop_run");
+        exit(EXIT_FAILURE);
+    }
+    buf_pool_thread_flush(); // the loop stopped (-R handover): its cached blocks go back
+    return NULL;
+}
+
+// Gauges for -M, read on loop 0 at scrape time
+static double gauge_connections(void *arg)
+{
+    (void)arg;
+    return live_clients();
+}
+
+static double gauge_pool(void *arg)
+{
+    struct thread_pool_stats st;
+
+    thread_pool_stats(pool, &st);
+    return arg == NULL ? st.queue_depth : st.busy;
+}
+
+static double gauge_buffers(void *arg)
+{
+    struct buf_pool_stats bs;
+    (void)arg;
+
+    buf_pool_stats(&bs);
+    return (double)bs.blocks;
+}
+
+static double gauge_shed(void *arg)
+{
+    (void)arg;
+    return __atomic_load_n(&cores[0].shed, __ATOMIC_RELAXED);
+}
+
+// -a: sockets the acceptor has posted that the worker loops have not adopted yet
+static double gauge_handoff_depth(void *arg)
+{
+    size_t n = 0;
+    (void)arg;
+
+    for (int i = 1; i < ncores; i++)
+        n += event_loop_post_depth(cores[i].loop);
+    return (double)n;
+}
+
+static void metrics_init(const char *addr)
+{
+    metrics_gauge("connections_active", "Connections currently open", gauge_connections, NULL);
+    metrics_gauge("buffer_blocks", "I/O buffer blocks allocated (in use or cached)", gauge_buffers, NULL);
+    if (pool != NULL)
+    {
+        metrics_gauge("pool_queue_depth", "Tasks waiting for a pool worker", gauge_pool, NULL);
+        metrics_gauge("pool_busy_workers", "Pool workers running a task", gauge_pool, pool);
+    }
+    if (handoff)
+    {
+        metrics_gauge("handoff_shed_connections", "Connections closed because every worker queue was full",
+                      gauge_shed, NULL);
+        metrics_gauge("handoff_queue_depth", "Messages waiting in the worker loops' queues, mostly new sockets",
+                      gauge_handoff_depth, NULL);
+    }
+    if (metrics_listen(cores[0].loop, addr) < 0)
+    {
+        perror("metrics_listen");
+        exit(EXIT_FAILURE);
+    }
+    metrics_on = TRUE;
+}
+
+static int cpu_count(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu > 0 ? (int)ncpu : 1;
+}
+
+// Keep each loop on one CPU so its connections and buffers stay in that CPU's cache
+static void pin_to_cpu(pthread_t thread, int id)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (ncpu <= 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(id % ncpu, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+int main(int argc, char *argv[])
+{
+    int workers = -1, queue_capacity = 0, c, sfd;
+    const char *backend = "epoll";
+    const char *metrics_addr = NULL;
+    sigset_t mask;
+
+    while ((c = getopt(argc, argv, "p:b:w:q:c:fm:u:i:D:a:M:L:l:B:C:O:R:U:x:X:")) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'b':
+            backend = optarg;
+            break;
+        case 'f':
+            framed = TRUE;
+            break;
+        case 'm':
+            buf_pool_init((size_t)atol(optarg) << 20);
+            break;
+        case 'i':
+            idle_ms = (uint64_t)atol(optarg) * 1000;
+            break;
+        case 'D':
+            reply_delay = (uint64_t)atol(optarg);
+            break;
+        case 'u':
+            udp_batch = atoi(optarg);
+            if (udp_batch < 1)
+                udp_batch = 1;
+            if (udp_batch > UDP_MAX_BATCH)
+                udp_batch = UDP_MAX_BATCH;
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'q':
+            queue_capacity = atoi(optarg);
+            break;
+        case 'c':
+            ncores = atoi(optarg) > 0 ? atoi(optarg) : cpu_count();
+            break;
+        case 'M':
+            metrics_addr = optarg;
+            break;
+        case 'L':
+            if ((c = log_level_parse(optarg)) < 0)
+            {
+                fprintf(stderr, "unknown log level %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            base_level = c;
+            break;
+        case 'l':
+            if (strcmp(optarg, "nl") == 0)
+                delim = '\n';
+            else if (strcmp(optarg, "nul") == 0)
+                delim = '\0';
+            else
             {
-                // Create a new thread for each client
-                pthread_t client_thread;
-                if (pthread_create(&client_thread, NULL, handle_client, (void *)&sd) < 0)
-                {
-                    perror("Could not create thread");
-                    return 1;
-                }
-                printf("Handler assigned\n");
+                fprintf(stderr, "unknown delimiter %s, use nl or nul\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'B':
+            backlog = atoi(optarg);
+            break;
+        case 'C':
+            max_clients = atol(optarg);
+            break;
+        case 'O':
+            if (strcmp(optarg, "shed") == 0)
+                shed_overload = TRUE;
+            else if (strcmp(optarg, "delay") != 0)
+            {
+                fprintf(stderr, "unknown overload policy %s, use delay or shed\n", optarg);
+                exit(EXIT_FAILURE);
             }
+            break;
+        case 'R':
+            restart_path = optarg;
+            break;
+        case 'U':
+            if (strcmp(optarg, "all") == 0)
+                take_over = TAKE_ALL;
+            else if (strcmp(optarg, "listeners") == 0)
+                take_over = TAKE_LISTENERS;
+            else
+            {
+                fprintf(stderr, "unknown -U %s, use listeners or all\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            unix_path = optarg;
+            break;
+        case 'X':
+            shm_path = optarg;
+            break;
+        case 'a':
+            handoff = TRUE;
+            ncores = (atoi(optarg) > 0 ? atoi(optarg) : cpu_count()) + 1; // plus the acceptor
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-b epoll|uring] [-w workers] [-q queue] [-c cores] [-f] [-m MB] [-u batch] [-i idle_secs] [-D delay_ms] [-a workers] [-M port|path] [-L level] [-l nl|nul] [-B backlog] [-C max_conns] [-O delay|shed] [-R path [-U listeners|all]] [-x path] [-X path]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (workers >= 0 && ncores > 1)
+    {
+        fprintf(stderr, "-w excludes -c and -a: per-core loops do not share a worker pool\n");
+        exit(EXIT_FAILURE);
+    }
+    if (take_over && restart_path == NULL)
+    {
+        fprintf(stderr, "-U takes over through the socket given with -R\n");
+        exit(EXIT_FAILURE);
+    }
+    if (framed && delim >= 0)
+    {
+        fprintf(stderr, "-f and -l are different protocols, pick one\n");
+        exit(EXIT_FAILURE);
+    }
+    if (workers >= 0 && reply_delay > 0)
+    {
+        fprintf(stderr, "-D needs the clients on the loop thread, it cannot be used with -w\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(backend, "uring") == 0)
+    {
+        if (workers >= 0 || framed || delim >= 0 || udp_batch > 0 || idle_ms > 0 || reply_delay > 0 || handoff ||
+            metrics_addr || max_clients > 0 || restart_path || unix_path || shm_path)
+        {
+            fprintf(stderr, "-w, -f, -l, -u, -i, -D, -a, -M, -C, -R, -x and -X need the epoll backend\n");
+            exit(EXIT_FAILURE);
         }
+        use_uring = uring_supported();
+        if (!use_uring)
+            fprintf(stderr, "io_uring lacks multishot recv / buffer rings here, falling back to epoll\n");
     }
+    else if (strcmp(backend, "epoll") != 0)
+    {
+        fprintf(stderr, "unknown backend %s\n", backend);
+        exit(EXIT_FAILURE);
+    }
+
+    raise_fd_limit();
+    log_set_level(base_level);
+    if (log_init(stdout) < 0)
+    {
+        perror("log_init");
+        exit(EXIT_FAILURE);
+    }
+
+    // block SIGUSR1 before any thread exists so only the signalfd ever sees it
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
+    if (workers >= 0)
+    {
+        if ((pool = thread_pool_create(workers, queue_capacity)) == NULL)
+        {
+            perror("thread_pool_create");
+            exit(EXIT_FAILURE);
+        }
+        struct thread_pool_stats st;
+        thread_pool_stats(pool, &st);
+        printf("Worker pool: %d threads, queue of %d\n", st.nthreads, st.queue_capacity);
+    }
+
+    if (take_over)
+        restart_take_over();
+    if ((cores = aligned_alloc(64, ncores * sizeof(*cores))) == NULL)
+    {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(cores, 0, ncores * sizeof(*cores));
+    for (int i = 0; i < ncores; i++)
+        core_init(&cores[i], i);
+    printf("Listener on port %d with %d %s loop(s)\n", port, ncores, use_uring ? "io_uring" : "epoll");
+    if (metrics_addr != NULL)
+        metrics_init(metrics_addr);
+
+    // loop 0 runs on the main thread and also owns the signalfd
+    if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+        (!use_uring && event_loop_add(cores[0].loop, sfd, EPOLLIN, on_signal, NULL) < 0))
+    {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < ncores; i++)
+        cores[i].sigfd = i == 0 ? sfd : -1;
+    if (take_over)
+        restart_ready();
+    else if (restart_path != NULL)
+        restart_listen();
+
+    for (int i = 1; i < ncores; i++)
+    {
+        if (pthread_create(&cores[i].thread, NULL, core_main, &cores[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        pin_to_cpu(cores[i].thread, i);
+    }
+    if (ncores > 1)
+        pin_to_cpu(pthread_self(), 0);
+
+    puts("Waiting for connections ...");
+    fflush(stdout);
+    core_main(&cores[0]);
+
+    for (int i = 1; i < ncores; i++)
+        pthread_join(cores[i].thread, NULL);
+    thread_pool_destroy(pool);
+    for (int i = 0; i < ncores; i++)
+    {
+        event_loop_destroy(cores[i].loop);
+        conn_table_destroy(cores[i].clients);
+        if (cores[i].listener >= 0)
+            close(cores[i].listener);
+        if (cores[i].unix_listener >= 0)
+            close(cores[i].unix_listener);
+        if (cores[i].udp >= 0)
+            close(cores[i].udp);
+        free(cores[i].batch);
+    }
+    if (shm_listener >= 0)
+        close(shm_listener);
+    close(sfd);
+    free(cores);
+    log_shutdown();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,521 @@
+// Load generator for the echo / request-reply servers in this directory.
+//
+// Opens many connections spread over several threads (one epoll loop each) and
+// reports throughput and p50/p99/p99.9 latency from HDR-style histograms.
+//   closed loop (default): every connection sends its next request as soon as the
+//                          previous reply arrived
+//   open loop (-r rate):   requests are issued on a fixed schedule; latency is measured
+//                          from the scheduled time so queueing delay is not hidden
+// Build: gcc -O2 -o loadgen loadgen.c event_loop.c timer_wheel.c mpsc_ring.c hdr_hist.c net_util.c frame.c -lpthread
+//
+// Usage: loadgen [-h host] [-p port] [-c conns] [-t threads] [-d secs] [-W warmup_secs]
+//                [-s size] [-e reply_size] [-r rate] [-n] [-f | -l | -H path] [-L label]
+//   -e N  bytes to expect per reply (default: same as -s, i.e. an echo)
+//   -n    new connection per request; the reply ends after reply_size bytes or at EOF
+//         (example_serv.c style)
+//   -f    wrap each message in a frame.h header (for linux_sock_server_multi -f)
+//   -l    end each message with a newline (for linux_sock_server_multi -l nl)
+//   -H P  send "GET P" HTTP/1.1 requests instead (for http_server.c); the reply size
+//         is taken from one probe request made before the run
+//   -L    print one CSV line "label,req/s,MB/s,p50,p99,p99.9,max,errors" (latency in us)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "event_loop.h"
+#include "hdr_hist.h"
+#include "net_util.h"
+#include "frame.h"
+
+#define TRUE 1
+#define FALSE 0
+#define TICK_NS 1000000ull // open-loop pacing tick
+#define BACKLOG_MAX 65536  // open-loop requests waiting for a free connection
+
+enum
+{
+    ST_IDLE,
+    ST_CONNECTING,
+    ST_SENDING,
+    ST_RECEIVING,
+    ST_DEAD,
+};
+
+struct worker;
+
+struct slot
+{
+    int fd;
+    int state;
+    struct worker *w;
+    size_t sent;
+    size_t recvd;
+    uint64_t start_ns; // when the request was due (open loop) or sent (closed loop)
+};
+
+struct worker
+{
+    int id;
+    pthread_t thread;
+    struct event_loop *loop;
+    struct slot *slots;
+    int nslots;
+    int *idle;          // stack of idle slot indices
+    int nidle;
+    uint64_t *backlog;  // due times of open-loop requests waiting for a slot
+    int bl_head, bl_len;
+    double rate;        // requests per second for this thread, 0 = closed loop
+    uint64_t issued;
+    uint64_t t_start, t_measure, t_end;
+    int tfd;
+    char *rxbuf;
+
+    uint64_t completed; // counted after warmup
+    uint64_t errors;
+    uint64_t dropped;   // open-loop requests that did not fit the backlog
+    struct hdr_hist hist;
+};
+
+static struct sockaddr_in server;
+static char *payload;
+static size_t msg_size = 64, reply_size = 0;
+static int new_conn = FALSE;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// -H: send the request once on a blocking connection and return the size of the whole
+// response (headers plus Content-Length), or 0 if it cannot be determined
+static size_t probe_reply_size(void)
+{
+    char buf[8192], *end, *cl;
+    size_t got = 0, size = 0;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0 ||
+        send(fd, payload, msg_size, MSG_NOSIGNAL) != (ssize_t)msg_size)
+        goto out;
+    while (got < sizeof(buf) - 1)
+    {
+        ssize_t n = recv(fd, buf + got, sizeof(buf) - 1 - got, 0);
+        if (n <= 0)
+            goto out;
+        got += n;
+        buf[got] = '\0';
+        if ((end = strstr(buf, "\r\n\r\n")) != NULL)
+        {
+            if ((cl = strcasestr(buf, "\r\nContent-Length:")) != NULL && cl < end)
+                size = (size_t)(end + 4 - buf) + strtoul(cl + 17, NULL, 10);
+            break;
+        }
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    return size;
+}
+
+static void on_slot(struct event_loop *loop, int fd, uint32_t events, void *arg);
+
+static int open_socket(struct slot *s)
+{
+    int one = 1;
+
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->fd < 0)
+        return -1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s->fd, (struct sockaddr *)&server, sizeof(server)) < 0 && errno != EINPROGRESS)
+    {
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+    if (event_loop_add(s->w->loop, s->fd, EPOLLIN | EPOLLOUT, on_slot, s) < 0)
+    {
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void close_socket(struct slot *s)
+{
+    if (s->fd < 0)
+        return;
+    event_loop_del(s->w->loop, s->fd);
+    close(s->fd);
+    s->fd = -1;
+}
+
+static void slot_failed(struct slot *s)
+{
+    s->w->errors++;
+    close_socket(s);
+    // persistent connections are not re-established, the slot just stops
+    s->state = new_conn ? ST_IDLE : ST_DEAD;
+    if (new_conn)
+        s->w->idle[s->w->nidle++] = (int)(s - s->w->slots);
+}
+
+// Push the state machine as far as it goes without blocking
+static void slot_run(struct slot *s);
+
+// Reset the slot for a request due at the given time, without sending anything yet
+static void prepare_request(struct slot *s, uint64_t due)
+{
+    s->start_ns = due;
+    s->sent = s->recvd = 0;
+    if (new_conn)
+    {
+        if (open_socket(s) < 0)
+        {
+            slot_failed(s);
+            return;
+        }
+        s->state = ST_CONNECTING;
+        return;
+    }
+    s->state = ST_SENDING;
+}
+
+static void start_request(struct slot *s, uint64_t due)
+{
+    prepare_request(s, due);
+    if (s->state == ST_SENDING)
+        slot_run(s);
+}
+
+// Record the finished request and line up the next one for this slot. The caller
+// keeps driving the slot if it is left in ST_SENDING.
+static void request_done(struct slot *s)
+{
+    struct worker *w = s->w;
+    uint64_t t = now_ns();
+
+    if (s->start_ns >= w->t_measure && t <= w->t_end)
+    {
+        hdr_record(&w->hist, t - s->start_ns);
+        w->completed++;
+    }
+    if (new_conn)
+        close_socket(s);
+    s->state = ST_IDLE;
+
+    if (t >= w->t_end)
+        return;
+    if (w->rate == 0)
+        prepare_request(s, now_ns());
+    else if (w->bl_len > 0)
+    {
+        uint64_t due = w->backlog[w->bl_head];
+        w->bl_head = (w->bl_head + 1) % BACKLOG_MAX;
+        w->bl_len--;
+        prepare_request(s, due);
+    }
+    else
+        w->idle[w->nidle++] = (int)(s - w->slots);
+}
+
+static void slot_run(struct slot *s)
+{
+    size_t expect = reply_size ? reply_size : msg_size;
+
+    while (TRUE)
+    {
+        if (s->state == ST_SENDING)
+        {
+            ssize_t n = send(s->fd, payload + s->sent, msg_size - s->sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EINTR)
+                    return;
+                slot_failed(s);
+                return;
+            }
+            s->sent += n;
+            if (s->sent == msg_size)
+                s->state = ST_RECEIVING;
+            continue;
+        }
+        if (s->state == ST_RECEIVING)
+        {
+            ssize_t n = recv(s->fd, s->w->rxbuf, 65536, 0);
+            if (n > 0)
+            {
+                s->recvd += n;
+                if (s->recvd >= expect)
+                {
+                    request_done(s);
+                    continue;
+                }
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                return;
+            if (n == 0 && new_conn)
+            {
+                request_done(s);
+                return;
+            }
+            slot_failed(s);
+            return;
+        }
+        return;
+    }
+}
+
+static void on_slot(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct slot *s = arg;
+    (void)loop;
+    (void)fd;
+
+    if (s->state == ST_CONNECTING)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            slot_failed(s);
+            return;
+        }
+        s->state = ST_SENDING;
+    }
+    if (s->state == ST_SENDING || s->state == ST_RECEIVING)
+        slot_run(s);
+}
+
+// Open-loop pacing and the end of the run
+static void on_tick(struct event_loop *loop, int tfd, uint32_t events, void *arg)
+{
+    struct worker *w = arg;
+    uint64_t expirations, t = now_ns();
+    (void)events;
+
+    while (read(tfd, &expirations, sizeof(expirations)) > 0)
+        ;
+    if (t >= w->t_end)
+    {
+        event_loop_stop(loop);
+        return;
+    }
+    if (w->rate == 0)
+        return;
+
+    uint64_t due = (uint64_t)((double)(t - w->t_start) * w->rate / 1e9);
+    while (w->issued < due)
+    {
+        uint64_t when = w->t_start + (uint64_t)((double)w->issued * 1e9 / w->rate);
+        w->issued++;
+        if (w->nidle > 0)
+            start_request(&w->slots[w->idle[--w->nidle]], when);
+        else if (w->bl_len < BACKLOG_MAX)
+        {
+            w->backlog[(w->bl_head + w->bl_len) % BACKLOG_MAX] = when;
+            w->bl_len++;
+        }
+        else
+            w->dropped++;
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = TICK_NS;
+    its.it_interval.tv_nsec = w->rate > 0 ? TICK_NS : 0;
+    if (w->rate == 0)
+    {
+        // closed loop only needs to wake up at the end of the run
+        uint64_t left = w->t_end - now_ns();
+        its.it_value.tv_sec = left / 1000000000ull;
+        its.it_value.tv_nsec = left % 1000000000ull;
+    }
+    timerfd_settime(w->tfd, 0, &its, NULL);
+
+    // closed loop: every slot starts at once; open loop: slots wait for the schedule
+    for (int i = 0; i < w->nslots; i++)
+    {
+        if (w->rate == 0)
+            start_request(&w->slots[i], now_ns());
+        else
+            w->idle[w->nidle++] = i;
+    }
+
+    event_loop_run(w->loop);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1", *label = NULL;
+    int port = 8888, conns = 100, nthreads = 2, opt;
+    double duration = 10, warmup = 0, rate = 0;
+    int framed = FALSE, delimited = FALSE;
+    const char *http_path = NULL;
+    struct worker *workers;
+    struct hdr_hist total;
+    uint64_t completed = 0, errors = 0, dropped = 0;
+
+    while ((opt = getopt(argc, argv, "h:p:c:t:d:W:s:e:r:nflH:L:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': conns = atoi(optarg); break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'W': warmup = atof(optarg); break;
+        case 's': msg_size = strtoul(optarg, NULL, 10); break;
+        case 'e': reply_size = strtoul(optarg, NULL, 10); break;
+        case 'r': rate = atof(optarg); break;
+        case 'n': new_conn = TRUE; break;
+        case 'f': framed = TRUE; break;
+        case 'l': delimited = TRUE; break;
+        case 'H': http_path = optarg; break;
+        case 'L': label = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-c conns] [-t threads] [-d secs] [-W warmup_secs]\n"
+                            "          [-s size] [-e reply_size] [-r rate] [-n] [-f | -l | -H path] [-L label]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    if (conns < nthreads)
+        conns = nthreads;
+    if (msg_size == 0)
+        msg_size = 1;
+
+    raise_fd_limit();
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(host);
+
+    // no NUL bytes, so servers that still use strlen() echo the whole message
+    payload = malloc(msg_size + FRAME_HDR_LEN);
+    memset(payload, 'x', msg_size + FRAME_HDR_LEN);
+    if (framed)
+    {
+        // the reply to a frame is a frame of the same size
+        frame_put_header((unsigned char *)payload, (uint32_t)msg_size, FRAME_ECHO, 0, 0);
+        msg_size += FRAME_HDR_LEN;
+    }
+    else if (delimited)
+        payload[msg_size - 1] = '\n';
+    else if (http_path != NULL)
+    {
+        free(payload);
+        if (asprintf(&payload, "GET %s HTTP/1.1\r\nHost: loadgen\r\n\r\n", http_path) < 0)
+            return 1;
+        msg_size = strlen(payload);
+        if (reply_size == 0 && (reply_size = probe_reply_size()) == 0)
+        {
+            fprintf(stderr, "no usable response to GET %s\n", http_path);
+            return 1;
+        }
+    }
+
+    uint64_t t0 = now_ns();
+    workers = calloc(nthreads, sizeof(*workers));
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct worker *w = &workers[i];
+        w->id = i;
+        w->nslots = conns / nthreads + (i < conns % nthreads);
+        w->slots = calloc(w->nslots, sizeof(*w->slots));
+        w->idle = calloc(w->nslots, sizeof(*w->idle));
+        w->backlog = calloc(BACKLOG_MAX, sizeof(*w->backlog));
+        w->rxbuf = malloc(65536);
+        w->rate = rate / nthreads;
+        w->loop = event_loop_create();
+        w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (w->loop == NULL || w->tfd < 0 || event_loop_add(w->loop, w->tfd, EPOLLIN, on_tick, w) < 0)
+        {
+            perror("setup");
+            return 1;
+        }
+        hdr_init(&w->hist);
+
+        for (int j = 0; j < w->nslots; j++)
+        {
+            struct slot *s = &w->slots[j];
+            s->w = w;
+            s->fd = -1;
+            s->state = ST_IDLE;
+            // persistent connections are opened up front so connect cost is not measured
+            if (!new_conn && open_socket(s) < 0)
+            {
+                perror("connect");
+                return 1;
+            }
+        }
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < nthreads; i++)
+    {
+        workers[i].t_start = start;
+        workers[i].t_measure = start + (uint64_t)(warmup * 1e9);
+        workers[i].t_end = start + (uint64_t)((warmup + duration) * 1e9);
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+
+    hdr_init(&total);
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        hdr_merge(&total, &workers[i].hist);
+        completed += workers[i].completed;
+        errors += workers[i].errors;
+        dropped += workers[i].dropped;
+    }
+
+    double rps = completed / duration;
+    double mbps = rps * (double)(msg_size + (reply_size ? reply_size : msg_size)) / 1e6;
+    if (label != NULL)
+    {
+        printf("%s,%.0f,%.2f,%.1f,%.1f,%.1f,%.1f,%llu\n", label, rps, mbps,
+               hdr_percentile(&total, 50) / 1e3, hdr_percentile(&total, 99) / 1e3,
+               hdr_percentile(&total, 99.9) / 1e3, total.max / 1e3, (unsigned long long)(errors + dropped));
+        return 0;
+    }
+
+    printf("%d connections, %d threads, %s loop%s, %zu byte requests, connect phase %.1f ms\n",
+           conns, nthreads, rate > 0 ? "open" : "closed", new_conn ? " (connection per request)" : "",
+           msg_size, (start - t0) / 1e6);
+    if (rate > 0)
+        printf("target rate %.0f req/s\n", rate);
+    printf("requests %llu, errors %llu, dropped %llu\n", (unsigned long long)completed,
+           (unsigned long long)errors, (unsigned long long)dropped);
+    printf("throughput %.0f req/s, %.2f MB/s\n", rps, mbps);
+    printf("latency (us): mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           hdr_mean(&total) / 1e3, hdr_percentile(&total, 50) / 1e3, hdr_percentile(&total, 90) / 1e3,
+           hdr_percentile(&total, 99) / 1e3, hdr_percentile(&total, 99.9) / 1e3, total.max / 1e3);
+    return 0;
+}
@@ -0,0 +1,260 @@
+// Asynchronous logger, see log.h
+//
+// Each thread's ring is single-producer / single-consumer: the owning thread advances
+// tail, the flusher advances head, and neither ever writes the other's index. Rings are
+// created on a thread's first log call and pushed lock-free onto a global list that
+// only grows, so the flusher can walk it while threads come and go. A ring outlives its
+// thread; whatever it still holds is written on the next pass.
+//
+// With every ring empty the flusher blocks on an eventfd, after announcing it in
+// flusher_asleep and looking at the rings once more. A producer writes the eventfd only
+// when it finds that flag set, i.e. once per sleep, on the transition from empty to
+// non-empty; an idle process never wakes the flusher and a busy one never syscalls.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+
+#define RING_SIZE 4096        // records per thread, a power of two
+#define OUT_BUF_SIZE (256 * 1024)
+
+struct record
+{
+    uint64_t ts;     // CLOCK_REALTIME in ns
+    const char *fmt;
+    int level;
+    long args[LOG_MAX_ARGS];
+};
+
+struct log_ring
+{
+    size_t tail __attribute__((aligned(64))); // next record the owner writes
+    uint64_t dropped;                         // records lost to a full ring, owner writes
+    size_t head __attribute__((aligned(64))); // next record the flusher reads
+    uint64_t reported;                        // drops already reported, flusher only
+    struct log_ring *next;
+    struct record rec[RING_SIZE];
+};
+
+int log_level = LOG_INFO;
+
+static __thread struct log_ring *ring_tls;
+static struct log_ring *rings; // every ring ever created, pushed lock-free
+
+static FILE *log_out;          // our own stream on the output's fd, so the caller's
+static int own_out;            // buffering of out is left alone
+static int wake_fd = -1;       // eventfd the flusher sleeps on
+static int flusher_asleep;     // set by the flusher before it blocks on wake_fd
+static pthread_t flusher;
+static int running;
+static int stopping;
+
+static const char *const level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static void wake_flusher(void)
+{
+    uint64_t one = 1;
+
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        return; // the counter is saturated, so it is awake anyway
+}
+
+// Is any record waiting? Flusher only.
+static int pending(void)
+{
+    for (struct log_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+        if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != r->head)
+            return 1;
+    return 0;
+}
+
+static struct log_ring *ring_create(void)
+{
+    struct log_ring *r = aligned_alloc(64, sizeof(*r));
+
+    if (r == NULL)
+        return NULL;
+    r->head = r->tail = 0;
+    r->dropped = r->reported = 0;
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    ring_tls = r;
+    return r;
+}
+
+void log_emit(enum log_level level, const char *fmt, const long *args)
+{
+    struct log_ring *r = ring_tls;
+    struct timespec ts;
+    struct record *rec;
+    size_t tail;
+
+    if (r == NULL && (r = ring_create()) == NULL)
+        return; // no memory for a ring: logging is best effort
+    tail = r->tail;
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+    {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts); // vDSO, no syscall
+    rec = &r->rec[tail & (RING_SIZE - 1)];
+    rec->ts = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    rec->fmt = fmt;
+    rec->level = level;
+    memcpy(rec->args, args, sizeof(rec->args));
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    // pairs with the fence in flusher_main: either it sees this record, or we see it asleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&flusher_asleep, __ATOMIC_RELAXED) && __atomic_exchange_n(&flusher_asleep, 0, __ATOMIC_RELAXED))
+        wake_flusher();
+}
+
+static void write_record(const struct record *rec)
+{
+    time_t sec = (time_t)(rec->ts / 1000000000ull);
+    const long *a = rec->args;
+    struct tm tm;
+
+    localtime_r(&sec, &tm);
+    fprintf(log_out, "%02d:%02d:%02d.%06lu %-5s ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+            (unsigned long)(rec->ts % 1000000000ull / 1000), level_names[rec->level]);
+    // Unused trailing arguments are zero and ignored by the conversion
+    fprintf(log_out, rec->fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+    fputc('\n', log_out);
+}
+
+// Write out everything queued so far. Returns the number of records written.
+static size_t drain(void)
+{
+    size_t total = 0;
+
+    for (struct log_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    {
+        size_t head = r->head;
+        size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+
+        for (; head != tail; head++)
+            write_record(&r->rec[head & (RING_SIZE - 1)]);
+        total += tail - r->head;
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+        if (dropped != r->reported)
+        {
+            fprintf(log_out, "log: %llu records dropped on a full ring\n",
+                    (unsigned long long)(dropped - r->reported));
+            r->reported = dropped;
+        }
+    }
+    if (total > 0)
+        fflush(log_out); // one write() for the whole batch
+    return total;
+}
+
+static void *flusher_main(void *arg)
+{
+    uint64_t n;
+    (void)arg;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        if (drain() > 0)
+            continue;
+        __atomic_store_n(&flusher_asleep, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (pending() || __atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n(&flusher_asleep, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (read(wake_fd, &n, sizeof(n)) < 0 && errno != EINTR)
+            break; // cannot sleep: give up rather than spin
+    }
+    drain();
+    return NULL;
+}
+
+int log_init(FILE *out)
+{
+    sigset_t all, old;
+    int rc;
+
+    if (running)
+        return 0;
+    if ((wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        return -1;
+    // a stream of our own on the same file: setvbuf on out would also change how the
+    // caller's own output to it is buffered
+    log_out = out;
+    own_out = 0;
+    int fd = dup(fileno(out));
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (f != NULL)
+    {
+        setvbuf(f, NULL, _IOFBF, OUT_BUF_SIZE);
+        log_out = f;
+        own_out = 1;
+    }
+    else if (fd >= 0)
+        close(fd);
+    fflush(out); // what the caller wrote before goes out first
+    stopping = 0;
+    flusher_asleep = 0;
+    // The flusher must never be the thread a process-directed signal lands on
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&flusher, NULL, flusher_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        if (own_out)
+            fclose(log_out);
+        close(wake_fd);
+        wake_fd = -1;
+        errno = rc;
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void log_shutdown(void)
+{
+    if (!running)
+        return;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    wake_flusher();
+    pthread_join(flusher, NULL);
+    running = 0;
+    if (own_out)
+        fclose(log_out);
+    else
+        fflush(log_out);
+    close(wake_fd);
+    wake_fd = -1;
+}
+
+void log_set_level(enum log_level level)
+{
+    __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+int log_level_parse(const char *name)
+{
+    static const char *const names[] = {"debug", "info", "warn", "error", "off"};
+
+    for (int i = 0; i <= LOG_OFF; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
@@ -0,0 +1,75 @@
+// Asynchronous logger for the data path.
+//
+// A log call never formats, locks or writes: it copies the format pointer, a
+// timestamp and up to LOG_MAX_ARGS integer arguments into a fixed-size record in the
+// calling thread's own single-producer ring. A background thread started by
+// log_init() drains every ring, formats the records and writes them to the output in
+// one batch per pass. A thread whose ring is full drops the record and counts it; the
+// flusher reports the drops instead of ever making the hot path wait.
+//
+// Arguments are stored as long, so formats must use long conversions (%ld, %lu, %lx)
+// and the format must be a string literal (only its address is kept). The flusher
+// prefixes a timestamp and the level and appends the newline. Records from
+// different threads are written in the order they are drained, not strictly by time.
+//
+// log_debug() and friends test the runtime level before evaluating their arguments,
+// so a disabled call is one load and a predictable branch. Levels below
+// LOG_COMPILE_LEVEL (-DLOG_COMPILE_LEVEL=LOG_INFO) are compiled out entirely.
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+
+enum log_level
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+    LOG_OFF
+};
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_MAX_ARGS 6
+
+extern int log_level; // records below this are discarded; change with log_set_level
+
+// Start the flusher thread writing to out's file through a stream of its own, so the
+// buffering of out itself is left as it was. Returns 0, or -1 with errno set.
+int log_init(FILE *out);
+
+// Write out everything logged so far and stop the flusher
+void log_shutdown(void);
+
+// Any thread, at any time
+void log_set_level(enum log_level level);
+
+// Parse "debug", "info", "warn", "error" or "off". Returns -1 if name is none of them.
+int log_level_parse(const char *name);
+
+void log_emit(enum log_level level, const char *fmt, const long *args);
+
+#define log_enabled(level) \
+    ((level) >= LOG_COMPILE_LEVEL && (level) >= __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+
+// The leading 0 lets the argument list be empty; more than LOG_MAX_ARGS arguments is
+// an "excess elements" compiler warning
+#define LOG_AT(level, fmt, ...)                                    \
+    do                                                             \
+    {                                                              \
+        if (log_enabled(level))                                    \
+        {                                                          \
+            const long log_args_[LOG_MAX_ARGS + 1] = {0, ##__VA_ARGS__}; \
+            log_emit(level, fmt, log_args_ + 1);                   \
+        }                                                          \
+    } while (0)
+
+#define log_debug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,264 @@
+// Per-thread metrics and the scrape endpoint, see metrics.h
+#define _GNU_SOURCE // accept4, open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "event_loop.h"
+#include "net_util.h"
+
+#define MAX_GAUGES 32
+#define SCRAPE_TIMEOUT_MS 5000 // scrapers that do not hang up are dropped after this
+
+__thread struct metrics_shard *metrics_tls;
+static struct metrics_shard *shards; // every shard ever created, pushed lock-free
+
+struct gauge
+{
+    const char *name;
+    const char *help;
+    metrics_gauge_fn fn;
+    void *arg;
+};
+
+static struct gauge gauges[MAX_GAUGES];
+static int ngauges;
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counter_info[M_NCOUNTERS] = {
+    [M_ACCEPTED] = {"connections_accepted_total", "Connections accepted"},
+    [M_CLOSED] = {"connections_closed_total", "Connections closed"},
+    [M_BYTES_IN] = {"received_bytes_total", "Bytes received from clients"},
+    [M_BYTES_OUT] = {"sent_bytes_total", "Bytes sent to clients"},
+    [M_MSGS_IN] = {"received_messages_total", "Framed messages and datagrams received"},
+    [M_MSGS_OUT] = {"sent_messages_total", "Framed messages and datagrams sent"},
+    [M_REFUSED] = {"connections_refused_total", "Connections closed as soon as accepted, under overload or out of fds"},
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+    double scale; // recorded unit -> exported unit
+} hist_info[M_NHISTOGRAMS] = {
+    [M_SERVICE_NS] = {"service_time_seconds", "Time spent serving one readiness event", 1e-9},
+    [M_CONN_BYTES_IN] = {"connection_received_bytes", "Bytes received per connection, recorded at close", 1},
+    [M_CONN_BYTES_OUT] = {"connection_sent_bytes", "Bytes sent per connection, recorded at close", 1},
+    [M_CONN_MSGS] = {"connection_messages", "Framed or delimited messages received per connection, recorded at close", 1},
+};
+
+struct metrics_shard *metrics_shard_create(void)
+{
+    struct metrics_shard *s = aligned_alloc(64, sizeof(*s));
+
+    if (s == NULL)
+        abort(); // recording must not fail; there is no sensible way to carry on
+    memset(s->counters, 0, sizeof(s->counters));
+    for (int i = 0; i < M_NHISTOGRAMS; i++)
+        hdr_init(&s->hist[i]);
+    s->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&shards, &s->next, s, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    metrics_tls = s;
+    return s;
+}
+
+void metrics_gauge(const char *name, const char *help, metrics_gauge_fn fn, void *arg)
+{
+    if (ngauges < MAX_GAUGES)
+        gauges[ngauges++] = (struct gauge){name, help, fn, arg};
+}
+
+char *metrics_render(void)
+{
+    struct metrics_shard *head = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    struct hdr_hist *h = malloc(sizeof(*h));
+    char *text = NULL;
+    size_t len;
+    FILE *out;
+
+    if (h == NULL || (out = open_memstream(&text, &len)) == NULL)
+    {
+        free(h);
+        return NULL;
+    }
+
+    for (int i = 0; i < M_NCOUNTERS; i++)
+    {
+        uint64_t total = 0;
+        for (struct metrics_shard *s = head; s != NULL; s = s->next)
+            total += __atomic_load_n(&s->counters[i], __ATOMIC_RELAXED);
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_info[i].name, counter_info[i].help,
+                counter_info[i].name, counter_info[i].name, (unsigned long long)total);
+    }
+
+    // Histograms are summed while their owners keep recording; a scrape can be a few
+    // samples behind but never blocks them
+    for (int i = 0; i < M_NHISTOGRAMS; i++)
+    {
+        const char *name = hist_info[i].name;
+        double scale = hist_info[i].scale;
+
+        hdr_init(h);
+        for (struct metrics_shard *s = head; s != NULL; s = s->next)
+            hdr_merge(h, &s->hist[i]);
+        fprintf(out, "# HELP %s %s\n# TYPE %s summary\n", name, hist_info[i].help, name);
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+            fprintf(out, "%s{quantile=\"%g\"} %g\n", name, quantiles[q],
+                    hdr_percentile(h, quantiles[q] * 100.0) * scale);
+        fprintf(out, "%s_sum %g\n%s_count %llu\n", name, h->sum * scale, name, (unsigned long long)h->count);
+    }
+
+    for (int i = 0; i < ngauges; i++)
+        fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %g\n", gauges[i].name, gauges[i].help,
+                gauges[i].name, gauges[i].name, gauges[i].fn(gauges[i].arg));
+
+    fclose(out);
+    free(h);
+    return text;
+}
+
+// One scrape in progress: the rendered response and how much of it went out
+struct scrape
+{
+    int fd;
+    struct event_loop *loop;
+    char *buf;
+    size_t len;
+    size_t off;
+    struct timer timeout;
+};
+
+static void scrape_close(struct scrape *s)
+{
+    event_loop_timer_del(s->loop, &s->timeout);
+    event_loop_del(s->loop, s->fd);
+    close(s->fd);
+    free(s->buf);
+    free(s);
+}
+
+static void on_scrape_timeout(struct timer *t, void *arg)
+{
+    (void)t;
+    scrape_close(arg);
+}
+
+// Send the response, then wait for the scraper to hang up. Closing with its request
+// still unread would reset the connection and could cut the response short.
+static void on_scrape(struct event_loop *loop, int fd, uint32_t events, void *arg)
+{
+    struct scrape *s = arg;
+    char discard[1024];
+    ssize_t n;
+    (void)loop;
+    (void)events;
+
+    while (s->off < s->len)
+    {
+        n = send(fd, s->buf + s->off, s->len - s->off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            scrape_close(s);
+            return;
+        }
+        s->off += n;
+        if (s->off == s->len)
+            shutdown(fd, SHUT_WR);
+    }
+    while ((n = read(fd, discard, sizeof(discard))) > 0 || (n < 0 && errno == EINTR))
+        ;
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        scrape_close(s);
+}
+
+static void on_admin_accept(struct event_loop *loop, int listener, uint32_t events, void *arg)
+{
+    static const char header[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n";
+    (void)events;
+    (void)arg;
+
+    while (1)
+    {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        struct scrape *s = calloc(1, sizeof(*s));
+        char *body = metrics_render();
+        if (s == NULL || body == NULL || (s->buf = malloc(sizeof(header) + strlen(body))) == NULL)
+        {
+            free(s);
+            free(body);
+            close(fd);
+            continue;
+        }
+        s->len = sprintf(s->buf, "%s%s", header, body);
+        free(body);
+        s->fd = fd;
+        s->loop = loop;
+        timer_init(&s->timeout, on_scrape_timeout, s);
+        if (event_loop_add(loop, fd, EPOLLIN | EPOLLOUT, on_scrape, s) < 0)
+        {
+            close(fd);
+            free(s->buf);
+            free(s);
+            continue;
+        }
+        event_loop_timer_add(loop, &s->timeout, SCRAPE_TIMEOUT_MS);
+    }
+}
+
+int metrics_listen(struct event_loop *loop, const char *addr)
+{
+    int fd, saved;
+
+    if (addr[0] == '/')
+    {
+        if ((fd = unix_listen(addr, SOCK_STREAM, 16)) < 0)
+            return -1;
+    }
+    else
+    {
+        struct sockaddr_in in;
+        int opt = 1;
+
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never expose metrics beyond the host
+        in.sin_port = htons(atoi(addr));
+        if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (bind(fd, (struct sockaddr *)&in, sizeof(in)) < 0 || listen(fd, 16) < 0)
+            goto fail;
+    }
+    if (set_nonblocking(fd) < 0 || event_loop_add(loop, fd, EPOLLIN, on_admin_accept, NULL) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+}
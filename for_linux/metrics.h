@@ -0,0 +1,84 @@
+// Process metrics in Prometheus text format.
+//
+// Every thread that records anything gets its own cache-line-aligned shard of
+// counters and histograms, so the hot path is a plain add to memory no other thread
+// writes: no atomics with a lock prefix, no shared cache lines. A scrape walks the
+// list of shards and sums them without stopping the writers; the totals are exact for
+// counters and at worst a few samples behind for histograms.
+//
+// Gauges (active connections, queue depths, ...) are read on demand from callbacks
+// registered with metrics_gauge().
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include "hdr_hist.h"
+
+struct event_loop;
+
+enum metrics_counter
+{
+    M_ACCEPTED,     // connections accepted
+    M_CLOSED,       // connections closed
+    M_BYTES_IN,
+    M_BYTES_OUT,
+    M_MSGS_IN,      // framed messages / datagrams received
+    M_MSGS_OUT,
+    M_REFUSED,      // connections closed on accept: overload (-O shed) or out of fds
+    M_NCOUNTERS
+};
+
+enum metrics_histogram
+{
+    M_SERVICE_NS,   // time spent serving one readiness event, in ns
+    M_CONN_BYTES_IN,  // bytes received over a connection's lifetime, recorded at close
+    M_CONN_BYTES_OUT, // bytes sent over a connection's lifetime, recorded at close
+    M_CONN_MSGS,      // messages received over a connection's lifetime (framed / delimited)
+    M_NHISTOGRAMS
+};
+
+struct metrics_shard
+{
+    uint64_t counters[M_NCOUNTERS];
+    struct hdr_hist hist[M_NHISTOGRAMS];
+    struct metrics_shard *next;
+} __attribute__((aligned(64)));
+
+extern __thread struct metrics_shard *metrics_tls;
+struct metrics_shard *metrics_shard_create(void);
+
+// The calling thread's shard, created on first use
+static inline struct metrics_shard *metrics_local(void)
+{
+    return metrics_tls != NULL ? metrics_tls : metrics_shard_create();
+}
+
+// Only the owning thread writes a shard, so a relaxed load + store is enough and
+// scrapers still never see a torn value
+static inline void metrics_add(enum metrics_counter id, uint64_t n)
+{
+    struct metrics_shard *s = metrics_local();
+    __atomic_store_n(&s->counters[id], s->counters[id] + n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_record(enum metrics_histogram id, uint64_t value)
+{
+    hdr_record(&metrics_local()->hist[id], value);
+}
+
+// Register a gauge read at scrape time. name must be a valid Prometheus metric name.
+typedef double (*metrics_gauge_fn)(void *arg);
+void metrics_gauge(const char *name, const char *help, metrics_gauge_fn fn, void *arg);
+
+// Render every metric in Prometheus text exposition format. Returns a malloc'ed,
+// NUL-terminated string, or NULL.
+char *metrics_render(void);
+
+// Serve metrics_render() to anyone who connects to addr: a port number (bound to
+// 127.0.0.1) or an absolute path for a Unix socket. Runs on loop's thread; the
+// response is preceded by a minimal HTTP header so curl and Prometheus can scrape it.
+// Returns 0, or -1 with errno set.
+int metrics_listen(struct event_loop *loop, const char *addr);
+
+#endif
@@ -0,0 +1,104 @@
+// Bounded MPSC ring, see mpsc_ring.h
+//
+// Slot i is free for the producer that claims position p (p % capacity == i) when its
+// seq equals p, and holds a message for the consumer at position p when seq equals
+// p + 1. Consuming sets seq to p + capacity, handing the slot to the next lap.
+#include <stdlib.h>
+#include <errno.h>
+
+#include "mpsc_ring.h"
+
+struct slot
+{
+    size_t seq;
+    struct mpsc_msg msg;
+};
+
+struct mpsc_ring
+{
+    size_t tail __attribute__((aligned(64))); // next position producers claim
+    size_t head __attribute__((aligned(64))); // next position the consumer reads
+    size_t mask;
+    struct slot *slots;
+};
+
+struct mpsc_ring *mpsc_ring_create(size_t capacity)
+{
+    struct mpsc_ring *r;
+    size_t n = 2;
+
+    while (n < capacity)
+        n *= 2;
+    if ((r = aligned_alloc(64, sizeof(*r))) == NULL)
+        return NULL;
+    if ((r->slots = malloc(n * sizeof(struct slot))) == NULL)
+    {
+        free(r);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++)
+        r->slots[i].seq = i;
+    r->mask = n - 1;
+    r->head = r->tail = 0;
+    return r;
+}
+
+void mpsc_ring_destroy(struct mpsc_ring *r)
+{
+    if (r == NULL)
+        return;
+    free(r->slots);
+    free(r);
+}
+
+int mpsc_ring_push(struct mpsc_ring *r, const struct mpsc_msg *msg)
+{
+    size_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    while (1)
+    {
+        struct slot *s = &r->slots[pos & r->mask];
+        size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0)
+        {
+            // slot is free for this lap: claim the position, then fill it
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                s->msg = *msg;
+                __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            // lost the race, pos now holds the current tail
+        }
+        else if (dif < 0)
+        {
+            errno = EAGAIN; // the consumer has not freed this slot yet: full
+            return -1;
+        }
+        else
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    }
+}
+
+int mpsc_ring_pop(struct mpsc_ring *r, struct mpsc_msg *msg)
+{
+    size_t pos = r->head;
+    struct slot *s = &r->slots[pos & r->mask];
+
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return 0; // empty, or the producer that claimed it is still writing
+    *msg = s->msg;
+    __atomic_store_n(&s->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    r->head = pos + 1;
+    return 1;
+}
+
+size_t mpsc_ring_depth(struct mpsc_ring *r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    return tail > head ? tail - head : 0; // head can be read before a pop that overtakes tail
+}
@@ -0,0 +1,39 @@
+// Bounded lock-free multi-producer / single-consumer message ring.
+//
+// Every slot carries a sequence number that tells producers and the consumer whose
+// turn it is, so producers only contend on one compare-and-swap of the tail and the
+// consumer never writes anything a producer reads except the slot it just freed.
+// Neither side ever takes a lock or blocks; a full ring makes mpsc_ring_push fail.
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A message is a function for the consumer to run and its two arguments
+typedef void (*mpsc_fn)(void *arg, intptr_t val);
+
+struct mpsc_msg
+{
+    mpsc_fn fn;
+    void *arg;
+    intptr_t val;
+};
+
+struct mpsc_ring;
+
+// capacity is rounded up to a power of two. Returns NULL and sets errno on failure.
+struct mpsc_ring *mpsc_ring_create(size_t capacity);
+void mpsc_ring_destroy(struct mpsc_ring *r);
+
+// Any thread. Returns 0, or -1 with errno = EAGAIN when the ring is full.
+int mpsc_ring_push(struct mpsc_ring *r, const struct mpsc_msg *msg);
+
+// Consumer thread only. Returns 1 and fills *msg, or 0 when the ring is empty.
+int mpsc_ring_pop(struct mpsc_ring *r, struct mpsc_msg *msg);
+
+// Messages claimed by producers and not yet popped. Any thread; only a snapshot while
+// the others keep going.
+size_t mpsc_ring_depth(struct mpsc_ring *r);
+
+#endif
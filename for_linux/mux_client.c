@@ -0,0 +1,440 @@
+// Pipelined request/reply client, see mux_client.h
+//
+// A request occupies one of 2^bits slots until its reply is dispatched. Its id is the
+// slot index in the low bits and a per-slot sequence number above them, so a stray or
+// duplicate reply for a slot that has since been reused does not match.
+//
+// Over shared memory the output queue only holds what did not fit in the ring; flush
+// moves it across frame by frame once the server has made room.
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+#include "mux_client.h"
+#include "net_util.h"
+#include "shm_ring.h"
+
+#define MAX_IOV 64
+#define FLUSH_AT (64 * 1024) // mux_send flushes once this much is queued
+#define SPIN_NS 50000        // shared memory: poll the ring this long before sleeping
+
+struct pending
+{
+    uint32_t id;
+    mux_reply_fn fn;   // NULL while the slot is free
+    void *arg;
+};
+
+struct mux_client
+{
+    int fd;            // the connection, or the shared-memory channel's control socket
+    struct shm_channel *shm; // NULL unless connected with mux_connect_shm
+    int window;
+    int inflight;
+    int bits;          // slot index bits in an id
+    int nfree;
+    int *free_slots;   // stack of free slot indices
+    struct pending *slots;
+    struct buf_chain out;
+    struct buf_chain in;
+};
+
+// A client with no connection yet (fd -1)
+static struct mux_client *mux_alloc(int window)
+{
+    struct mux_client *m;
+
+    if (window < 1 || window > MUX_MAX_WINDOW)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((m = calloc(1, sizeof(*m))) == NULL)
+        return NULL;
+    m->fd = -1;
+    while ((1 << m->bits) < window)
+        m->bits++;
+    m->window = window;
+    m->slots = calloc(1 << m->bits, sizeof(*m->slots));
+    m->free_slots = malloc(window * sizeof(*m->free_slots));
+    if (m->slots == NULL || m->free_slots == NULL)
+    {
+        mux_close(m);
+        return NULL;
+    }
+    for (int i = window - 1; i >= 0; i--)
+        m->free_slots[m->nfree++] = i;
+    buf_chain_init(&m->out);
+    buf_chain_init(&m->in);
+    return m;
+}
+
+// mux_close, keeping errno for the caller of a failed connect
+static struct mux_client *connect_failed(struct mux_client *m)
+{
+    int saved = errno;
+
+    mux_close(m);
+    errno = saved;
+    return NULL;
+}
+
+struct mux_client *mux_connect(const char *host, int port, int window)
+{
+    struct sockaddr_in addr;
+    struct mux_client *m;
+    int one = 1;
+
+    if ((m = mux_alloc(window)) == NULL)
+        return NULL;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        errno = EINVAL;
+        return connect_failed(m);
+    }
+    if ((m->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(m->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return connect_failed(m);
+    // Writes are batched by hand, Nagle would only add latency to the last of them
+    setsockopt(m->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    set_nonblocking(m->fd);
+    return m;
+}
+
+struct mux_client *mux_connect_unix(const char *path, int window)
+{
+    struct mux_client *m;
+
+    if ((m = mux_alloc(window)) == NULL)
+        return NULL;
+    if ((m->fd = unix_connect(path, SOCK_STREAM)) < 0)
+        return connect_failed(m);
+    set_nonblocking(m->fd);
+    return m;
+}
+
+struct mux_client *mux_connect_shm(const char *path, int window)
+{
+    uint32_t magic = SHM_MAGIC;
+    struct mux_client *m;
+    int fds[3];
+
+    if ((m = mux_alloc(window)) == NULL)
+        return NULL;
+    if ((m->shm = malloc(sizeof(*m->shm))) == NULL)
+        return connect_failed(m);
+    if (shm_channel_create(m->shm) < 0)
+    {
+        free(m->shm);
+        m->shm = NULL;
+        return connect_failed(m);
+    }
+    fds[0] = m->shm->memfd;
+    fds[1] = m->shm->peer_fd;
+    fds[2] = m->shm->event_fd;
+    // the control socket stays open: closing it is how the server learns we have gone
+    if ((m->fd = unix_connect(path, SOCK_SEQPACKET)) < 0 || fd_send(m->fd, &magic, sizeof(magic), fds, 3) < 0)
+        return connect_failed(m);
+    set_nonblocking(m->fd);
+    return m;
+}
+
+void mux_close(struct mux_client *m)
+{
+    if (m == NULL)
+        return;
+    if (m->fd >= 0)
+        close(m->fd);
+    if (m->shm != NULL)
+    {
+        shm_channel_close(m->shm);
+        free(m->shm);
+    }
+    buf_chain_clear(&m->out);
+    buf_chain_clear(&m->in);
+    free(m->slots);
+    free(m->free_slots);
+    free(m);
+}
+
+int mux_inflight(const struct mux_client *m)
+{
+    return m->inflight;
+}
+
+// The connection is gone: every request still outstanding gets its callback once
+static int fail_all(struct mux_client *m, int err)
+{
+    for (int i = 0; i < (1 << m->bits); i++)
+    {
+        struct pending *p = &m->slots[i];
+        mux_reply_fn fn = p->fn;
+
+        if (fn == NULL)
+            continue;
+        p->fn = NULL;
+        m->free_slots[m->nfree++] = i;
+        m->inflight--;
+        fn(p->arg, p->id, 0, NULL, 0);
+    }
+    buf_chain_clear(&m->out);
+    errno = err;
+    return -1;
+}
+
+// Shared memory: move queued frames into the ring until it is full, then wake the
+// server if it sleeps. A frame never straddles more than two blocks, so pullup is cheap.
+static int flush_shm(struct mux_client *m)
+{
+    const unsigned char *p;
+
+    while ((p = buf_chain_pullup(&m->out, FRAME_HDR_LEN)) != NULL)
+    {
+        size_t size = frame_size(p, FRAME_HDR_LEN);
+
+        if ((p = buf_chain_pullup(&m->out, size)) == NULL)
+            return -1; // only whole frames are queued
+        if (shm_send(m->shm, p, size, NULL, 0) < 0)
+            break; // full: the server wakes us once it has made room
+        buf_chain_consume(&m->out, size);
+    }
+    shm_notify(m->shm);
+    return 0;
+}
+
+// Send as much of the queue as the socket takes. Returns 0, or -1 on error.
+static int flush(struct mux_client *m)
+{
+    struct iovec iov[MAX_IOV];
+    struct msghdr msg;
+
+    if (m->shm != NULL)
+        return flush_shm(m);
+    while (m->out.len > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = buf_chain_iov(&m->out, iov, MAX_IOV);
+        ssize_t n = sendmsg(m->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        buf_chain_consume(&m->out, n);
+    }
+    return 0;
+}
+
+int64_t mux_send(struct mux_client *m, uint16_t type, const void *payload, size_t len, mux_reply_fn fn, void *arg)
+{
+    unsigned char hdr[FRAME_HDR_LEN];
+    struct pending *p;
+    int slot;
+
+    if (len > MUX_MAX_PAYLOAD)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (m->nfree == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    slot = m->free_slots[m->nfree - 1];
+    p = &m->slots[slot];
+    // next sequence number for this slot, skipping 0 so no id is ever 0
+    p->id = ((p->id >> m->bits) + 1) << m->bits | slot;
+    if (p->id == 0)
+        p->id = 1u << m->bits | slot;
+    frame_put_header(hdr, len, type, 0, p->id);
+    if (m->shm != NULL && m->out.len == 0 && shm_send(m->shm, hdr, sizeof(hdr), payload, len) == 0)
+        ; // straight into the ring; the server is woken, if need be, on the next poll
+    else if (buf_chain_append(&m->out, hdr, sizeof(hdr)) < 0)
+        return -1;
+    else if (buf_chain_append(&m->out, payload, len) < 0)
+    {
+        buf_chain_clear(&m->out); // a half-queued frame would corrupt the stream
+        return fail_all(m, ENOMEM);
+    }
+    p->fn = fn;
+    p->arg = arg;
+    m->nfree--;
+    m->inflight++;
+    if (m->out.len >= FLUSH_AT && flush(m) < 0)
+        return fail_all(m, errno);
+    return p->id;
+}
+
+// Run the callback of the request f answers. Returns 1, or 0 for an unknown id.
+static int complete(struct mux_client *m, const struct frame *f)
+{
+    uint32_t slot = f->id & ((1u << m->bits) - 1);
+    struct pending *r = &m->slots[slot];
+    mux_reply_fn fn = r->fn;
+
+    if (fn == NULL || r->id != f->id)
+        return 0;
+    r->fn = NULL;
+    m->free_slots[m->nfree++] = slot;
+    m->inflight--;
+    fn(r->arg, f->id, f->type, f->payload, f->len);
+    return 1;
+}
+
+// Shared memory: dispatch every reply in the ring, read in place. Returns how many, or -1.
+static int dispatch_shm(struct mux_client *m)
+{
+    const unsigned char *p;
+    size_t len;
+    int n = 0, rc;
+
+    while ((rc = shm_recv(m->shm, &p, &len)) > 0)
+    {
+        struct frame f;
+
+        if (frame_parse(p, len, MUX_MAX_PAYLOAD, &f) != (long)len)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        n += complete(m, &f);
+        shm_consume(m->shm);
+    }
+    return rc < 0 ? -1 : n;
+}
+
+// Dispatch every complete reply in the input queue. Returns how many, or -1.
+static int dispatch(struct mux_client *m)
+{
+    const unsigned char *p;
+    int n = 0;
+
+    while ((p = buf_chain_pullup(&m->in, FRAME_HDR_LEN)) != NULL)
+    {
+        size_t size = frame_size(p, FRAME_HDR_LEN);
+        struct frame f;
+
+        if (size > FRAME_HDR_LEN + MUX_MAX_PAYLOAD)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        if ((p = buf_chain_pullup(&m->in, size)) == NULL)
+            break;
+        frame_parse(p, size, MUX_MAX_PAYLOAD, &f);
+        n += complete(m, &f);
+        buf_chain_consume(&m->in, size); // unknown ids are dropped
+    }
+    return n;
+}
+
+// Read what has arrived. Returns 0 once drained, or -1 on EOF or error.
+static int fill(struct mux_client *m)
+{
+    while (1)
+    {
+        size_t avail;
+        unsigned char *p = buf_chain_reserve(&m->in, &avail);
+
+        if (p == NULL)
+            return -1;
+        ssize_t n = recv(m->fd, p, avail, 0);
+        if (n > 0)
+        {
+            buf_chain_commit(&m->in, n);
+            continue;
+        }
+        buf_chain_consume(&m->in, 0); // hand back the block if nothing landed in it
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n == 0)
+            errno = ECONNRESET;
+        return -1;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Shared memory: a reply to a request in flight is usually microseconds away, so look
+// at the ring for SPIN_NS before paying for a sleep and a wakeup. The server hanging up
+// shows on the control socket.
+static int poll_shm(struct mux_client *m, int timeout_ms)
+{
+    uint64_t spin_until = timeout_ms == 0 ? 0 : now_ns() + SPIN_NS;
+    int waited = 0, gone = 0;
+
+    while (1)
+    {
+        int n;
+
+        if (flush_shm(m) < 0 || (n = dispatch_shm(m)) < 0)
+            return fail_all(m, errno);
+        if (n > 0)
+            shm_notify(m->shm); // room for a server waiting on a full ring
+        if (n == 0 && gone)
+            return fail_all(m, ECONNRESET);
+        if (n > 0 || waited || (m->inflight == 0 && m->out.len == 0))
+            return n;
+        if (spin_until > 0 && now_ns() < spin_until)
+            continue;
+        if (!shm_prepare_sleep(m->shm))
+            continue;
+
+        struct pollfd pfd[2] = {{m->shm->event_fd, POLLIN, 0}, {m->fd, POLLIN | POLLRDHUP, 0}};
+        if (poll(pfd, 2, timeout_ms) < 0 && errno != EINTR)
+            return fail_all(m, errno);
+        shm_wake(m->shm);
+        gone = pfd[1].revents != 0;
+        waited = 1;
+    }
+}
+
+int mux_poll(struct mux_client *m, int timeout_ms)
+{
+    int waited = 0;
+
+    if (m->shm != NULL)
+        return poll_shm(m, timeout_ms);
+    while (1)
+    {
+        int n, rc;
+
+        if (flush(m) < 0)
+            return fail_all(m, errno);
+        rc = fill(m);
+        // replies that arrived before an EOF are still dispatched; the next poll fails
+        if ((n = dispatch(m)) < 0 || (rc < 0 && n == 0))
+            return fail_all(m, errno);
+        if (n > 0 || waited || (m->inflight == 0 && m->out.len == 0))
+            return n;
+
+        struct pollfd pfd = {m->fd, POLLIN | (m->out.len > 0 ? POLLOUT : 0), 0};
+        if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR)
+            return fail_all(m, errno);
+        waited = 1;
+    }
+}
@@ -0,0 +1,57 @@
+// Pipelined request/reply client over one TCP connection, speaking frame.h. A client
+// on the same host as the server can use a Unix socket instead, or a shared-memory
+// channel (shm_ring.h); the API is the same whichever transport is underneath.
+//
+// Up to window requests are in flight at once. Each gets a correlation id that the
+// server echoes in its reply, so replies are matched to their requests in whatever
+// order they arrive. mux_send() only queues a request; the queue goes out in as few
+// sendmsg() calls as possible the next time the client is polled, so a burst of small
+// requests costs one syscall rather than one round trip each.
+//
+// Single-threaded: a client belongs to the thread that polls it.
+#ifndef MUX_CLIENT_H
+#define MUX_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buf_pool.h"
+#include "frame.h"
+
+#define MUX_MAX_WINDOW 65536
+#define MUX_MAX_PAYLOAD (BUF_BLOCK_DATA - FRAME_HDR_LEN) // largest reply we can take
+
+struct mux_client;
+
+// Called from mux_poll() with the reply to a request. payload is only valid during the
+// call. On a connection error every outstanding callback runs once with type 0.
+typedef void (*mux_reply_fn)(void *arg, uint32_t id, uint16_t type, const unsigned char *payload, size_t len);
+
+// Connect to host:port (numeric IPv4) allowing window requests in flight. Returns
+// NULL with errno set on failure.
+struct mux_client *mux_connect(const char *host, int port, int window);
+
+// Same over the Unix stream socket at path (linux_sock_server_multi -x)
+struct mux_client *mux_connect_unix(const char *path, int window);
+
+// Same over a shared-memory channel set up through the Unix socket at path
+// (linux_sock_server_multi -X). Requests go straight into the ring and replies are
+// read in place. mux_poll spins briefly for replies before it sleeps, so a round trip
+// with a busy server costs no syscall at all.
+struct mux_client *mux_connect_shm(const char *path, int window);
+void mux_close(struct mux_client *m);
+
+// Queue a request of the given frame type. Returns its correlation id, or -1 with
+// errno = EAGAIN when window requests are already in flight (poll, then retry),
+// EMSGSIZE when len exceeds MUX_MAX_PAYLOAD, or ENOMEM.
+int64_t mux_send(struct mux_client *m, uint16_t type, const void *payload, size_t len, mux_reply_fn fn, void *arg);
+
+// Send what is queued and dispatch the replies that have arrived, waiting up to
+// timeout_ms (-1 = forever) for at least one. Returns the number of replies
+// dispatched, or -1 with errno set when the connection failed.
+int mux_poll(struct mux_client *m, int timeout_ms);
+
+// Requests sent or queued whose reply has not been dispatched yet
+int mux_inflight(const struct mux_client *m);
+
+#endif
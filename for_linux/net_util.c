@@ -0,0 +1,204 @@
+// Small socket helpers shared by the Linux servers, see net_util.h
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "net_util.h"
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Socket of the given type bound to INADDR_ANY:port, not yet non-blocking
+static int bind_any(int type, int port, int reuseport)
+{
+    int fd, opt = 1, saved;
+    struct sockaddr_in address;
+
+    if ((fd = socket(AF_INET, type | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+        goto fail;
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+        goto fail;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        goto fail;
+    return fd;
+
+fail:
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+}
+
+int tcp_listen(int port, int backlog, int reuseport)
+{
+    int fd, saved;
+
+    if ((fd = bind_any(SOCK_STREAM, port, reuseport)) < 0)
+        return -1;
+    if (listen(fd, backlog) < 0 || set_nonblocking(fd) < 0)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int udp_bind(int port, int reuseport)
+{
+    int fd, saved;
+
+    if ((fd = bind_any(SOCK_DGRAM, port, reuseport)) < 0)
+        return -1;
+    if (set_nonblocking(fd) < 0)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+void raise_fd_limit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static int unix_addr(struct sockaddr_un *un, const char *path)
+{
+    memset(un, 0, sizeof(*un));
+    un->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(un->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(un->sun_path, path);
+    return 0;
+}
+
+int unix_listen(const char *path, int type, int backlog)
+{
+    struct sockaddr_un un;
+    int fd, saved;
+
+    if (unix_addr(&un, path) < 0 || (fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    unlink(path); // left over from a previous run, or the process we are replacing
+    if (bind(fd, (struct sockaddr *)&un, sizeof(un)) < 0 || listen(fd, backlog) < 0)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int unix_connect(const char *path, int type)
+{
+    struct sockaddr_un un;
+    int fd, saved;
+
+    if (unix_addr(&un, path) < 0 || (fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int fd_send(int sock, const void *data, size_t len, const int *fds, int nfds)
+{
+    union
+    {
+        char buf[CMSG_SPACE(FD_PASS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = {(void *)data, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (nfds < 0 || nfds > FD_PASS_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nfds > 0)
+    {
+        struct cmsghdr *cm;
+
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0)
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+ssize_t fd_recv(int sock, void *data, size_t len, int *fds, int *nfds)
+{
+    union
+    {
+        char buf[CMSG_SPACE(FD_PASS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = {data, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf,
+                         .msg_controllen = sizeof(ctl.buf)};
+    ssize_t n;
+
+    *nfds = 0;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0)
+        if (errno != EINTR)
+            return -1;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        int k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (*nfds + k > FD_PASS_MAX)
+            k = FD_PASS_MAX - *nfds;
+        memcpy(fds + *nfds, CMSG_DATA(cm), k * sizeof(int));
+        *nfds += k;
+    }
+    return n;
+}
@@ -0,0 +1,41 @@
+// Small socket helpers shared by the Linux servers
+#ifndef NET_UTIL_H
+#define NET_UTIL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Create a non-blocking TCP socket listening on INADDR_ANY:port with SO_REUSEADDR.
+// With reuseport set, SO_REUSEPORT is enabled as well so several sockets (one per
+// event loop) can bind the same port and the kernel spreads connections across them.
+// Returns the fd, or -1 with errno set.
+int tcp_listen(int port, int backlog, int reuseport);
+
+// Same for a non-blocking UDP socket bound to INADDR_ANY:port
+int udp_bind(int port, int reuseport);
+
+// Put fd into O_NONBLOCK mode. Returns 0, or -1 with errno set.
+int set_nonblocking(int fd);
+
+// Raise RLIMIT_NOFILE to its hard limit so we can hold many thousands of sockets
+void raise_fd_limit(void);
+
+// Unix domain sockets of the given type (SOCK_STREAM or SOCK_SEQPACKET), blocking and
+// close-on-exec. unix_listen replaces whatever is left at path. Return the fd, or -1
+// with errno set (ENAMETOOLONG if path does not fit in sun_path).
+int unix_listen(const char *path, int type, int backlog);
+int unix_connect(const char *path, int type);
+
+#define FD_PASS_MAX 64 // descriptors per message, well under the kernel's SCM_MAX_FD
+
+// Send len bytes (at least 1) and nfds <= FD_PASS_MAX descriptors as one message over
+// the Unix socket sock, with SCM_RIGHTS. The receiver gets its own references; the
+// sender's stay open until it closes them. Returns 0, or -1 with errno set.
+int fd_send(int sock, const void *data, size_t len, const int *fds, int nfds);
+
+// Receive one such message: up to len bytes into data and its descriptors, marked
+// close-on-exec, into fds[FD_PASS_MAX]. Sets *nfds and returns the byte count, 0 at
+// EOF, or -1 with errno set.
+ssize_t fd_recv(int sock, void *data, size_t len, int *fds, int *nfds);
+
+#endif
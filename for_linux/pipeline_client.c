@@ -0,0 +1,193 @@
+// Pipelined client for linux_sock_server_multi -f, built on mux_client.c.
+//
+// Without -n it works like win_sock_client_multi.c: every line read from stdin is sent
+// as a message and the replies are printed as they come back. Unlike that client it
+// does not wait for a reply before sending the next line; up to -w messages are in
+// flight at once.
+//
+// With -n N it sends N messages of -s bytes as fast as the window allows, checks that
+// every reply carries back its own payload, and reports messages per second. -w 1 is
+// the lockstep baseline, one round trip per message.
+//
+// -x and -X connect through the server's Unix socket or shared-memory channel instead
+// of TCP; with -n N -w 1 they measure what a same-host round trip costs on each.
+// Build: gcc -O2 -o pipeline_client pipeline_client.c mux_client.c frame.c buf_pool.c net_util.c shm_ring.c -lpthread
+//
+// Usage: pipeline_client [-h host] [-p port] [-x unix_path | -X shm_path] [-w window] [-n count] [-s size]
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mux_client.h"
+
+#define PORT 8888
+#define DEFAULT_WINDOW 64
+
+static uint64_t replies;
+static uint64_t mismatches;
+static int failed;
+
+static void on_echo(void *arg, uint32_t id, uint16_t type, const unsigned char *payload, size_t len)
+{
+    uint64_t seq = (uintptr_t)arg, got;
+    (void)id;
+
+    if (type == 0)
+    {
+        failed = 1;
+        return;
+    }
+    replies++;
+    // every payload starts with the sequence number of its request
+    if (type != FRAME_ECHO_REPLY || len < sizeof(got))
+    {
+        mismatches++;
+        return;
+    }
+    memcpy(&got, payload, sizeof(got));
+    if (got != seq)
+        mismatches++;
+}
+
+static void on_line(void *arg, uint32_t id, uint16_t type, const unsigned char *payload, size_t len)
+{
+    (void)arg;
+
+    if (type == 0)
+    {
+        failed = 1;
+        return;
+    }
+    printf("reply %u: %.*s\n", id, (int)len, (const char *)payload);
+}
+
+static int run_bench(struct mux_client *m, uint64_t count, size_t size)
+{
+    unsigned char *msg = malloc(size);
+    struct timespec t0, t1;
+    uint64_t sent = 0;
+
+    if (msg == NULL)
+        return 1;
+    memset(msg, 'x', size);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (replies < count && !failed)
+    {
+        // fill the window, then wait for replies to open it up again
+        while (sent < count)
+        {
+            memcpy(msg, &sent, sizeof(sent));
+            if (mux_send(m, FRAME_ECHO, msg, size, on_echo, (void *)(uintptr_t)sent) < 0)
+                break;
+            sent++;
+        }
+        if (mux_poll(m, -1) < 0)
+        {
+            perror("mux_poll");
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(msg);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%llu replies (%llu mismatched) in %.3f s: %.0f msg/s, %.1f MB/s each way\n", (unsigned long long)replies,
+           (unsigned long long)mismatches, secs, secs > 0 ? replies / secs : 0.0,
+           secs > 0 ? replies * (double)size / secs / 1e6 : 0.0);
+    return replies == count && mismatches == 0 ? 0 : 1;
+}
+
+static int run_lines(struct mux_client *m)
+{
+    char line[MUX_MAX_PAYLOAD + 2];
+
+    while (!failed && fgets(line, sizeof(line), stdin) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        while (mux_send(m, FRAME_ECHO, line, strlen(line), on_line, NULL) < 0)
+        {
+            if (errno != EAGAIN || mux_poll(m, -1) < 0)
+            {
+                perror("send");
+                return 1;
+            }
+        }
+        // pick up whatever replies are already here without waiting for them
+        if (mux_poll(m, 0) < 0)
+        {
+            perror("mux_poll");
+            return 1;
+        }
+        fflush(stdout);
+    }
+    while (mux_inflight(m) > 0 && !failed)
+        if (mux_poll(m, -1) < 0)
+        {
+            perror("mux_poll");
+            return 1;
+        }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    const char *unix_path = NULL, *shm_path = NULL;
+    int port = PORT, window = DEFAULT_WINDOW, opt, rc;
+    uint64_t count = 0;
+    size_t size = 64;
+    struct mux_client *m;
+
+    while ((opt = getopt(argc, argv, "h:p:x:X:w:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'x':
+            unix_path = optarg;
+            break;
+        case 'X':
+            shm_path = optarg;
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'n':
+            count = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            size = (size_t)atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-x unix_path | -X shm_path] [-w window] [-n count] [-s size]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (size < sizeof(uint64_t) || size > MUX_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "-s must be between %zu and %d bytes\n", sizeof(uint64_t), (int)MUX_MAX_PAYLOAD);
+        return 1;
+    }
+    if (shm_path != NULL)
+        m = mux_connect_shm(shm_path, window);
+    else if (unix_path != NULL)
+        m = mux_connect_unix(unix_path, window);
+    else
+        m = mux_connect(host, port, window);
+    if (m == NULL)
+    {
+        perror("mux_connect");
+        return 1;
+    }
+    rc = count > 0 ? run_bench(m, count, size) : run_lines(m);
+    mux_close(m);
+    return rc;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Build every Linux server variant, run the same loadgen workload against each of them
+# on localhost and print one comparison table.
+#
+# Usage: ./run_bench.sh [loadgen options...]      e.g. ./run_bench.sh -c 500 -d 5 -s 128
+# Environment: BUILD (build directory, default ./bench_build), CC (default gcc), CXX (default g++)
+#
+# Echo servers get the options as given. example_serv.c replies with a fixed 18-byte
+# message and closes, so it is driven with -n -e 18 and should be compared on its own;
+# the same goes for http_server.c, which answers GET / with its banner.
+set -e
+cd "$(dirname "$0")"
+BUILD=${BUILD:-./bench_build}
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+CFLAGS=${CFLAGS:--O2}
+mkdir -p "$BUILD"
+
+$CC $CFLAGS -o "$BUILD/loadgen" loadgen.c event_loop.c timer_wheel.c mpsc_ring.c hdr_hist.c net_util.c frame.c -lpthread
+$CC $CFLAGS -o "$BUILD/example_serv" example_serv.c
+$CC $CFLAGS -o "$BUILD/linux_sock_server_multi" linux_sock_server_multi.c event_loop.c timer_wheel.c mpsc_ring.c thread_pool.c \
+    net_util.c uring_server.c frame.c buf_pool.c conn_table.c metrics.c hdr_hist.c log.c delim.c shm_ring.c -lpthread
+$CC $CFLAGS -o "$BUILD/http_server" http_server.c http.c event_loop.c timer_wheel.c mpsc_ring.c net_util.c buf_pool.c \
+    conn_table.c -lpthread
+# the C headers are not extern "C", so the coroutine server links C objects built apart
+for f in event_loop timer_wheel mpsc_ring net_util buf_pool; do
+    $CC $CFLAGS -c -o "$BUILD/$f.o" $f.c
+done
+$CXX -std=c++20 $CFLAGS -o "$BUILD/coro_echo_server" coro_echo_server.cpp coro.cpp "$BUILD/event_loop.o" \
+    "$BUILD/timer_wheel.o" "$BUILD/mpsc_ring.o" "$BUILD/net_util.o" "$BUILD/buf_pool.o" -lpthread
+
+PORT=18888
+PIDS=""
+cleanup()
+{
+    for p in $PIDS; do kill "$p" 2>/dev/null || true; done
+}
+trap cleanup EXIT INT TERM
+
+# run_case label "server command (PORT is substituted)" extra-loadgen-args
+# Prints the loadgen CSV line for the case.
+run_case()
+{
+    label=$1
+    cmd=$(echo "$2" | sed "s/PORT/$PORT/g")
+    shift 2
+    $cmd > /dev/null 2>&1 < /dev/null &
+    pid=$!
+    PIDS="$PIDS $pid"
+    sleep 0.5
+    if kill -0 "$pid" 2>/dev/null; then
+        "$BUILD/loadgen" -p "$PORT" -L "$label" "$@" || echo "$label,failed"
+    else
+        echo "$label,did-not-start"
+    fi
+    kill "$pid" 2>/dev/null || true
+    wait "$pid" 2>/dev/null || true
+    PORT=$((PORT + 1))
+}
+
+RESULTS="$BUILD/results.csv"
+echo "server,req/s,MB/s,p50_us,p99_us,p99.9_us,max_us,errors" > "$RESULTS"
+run_case fork-per-conn "$BUILD/example_serv PORT" -n -e 18 -c 16 "$@" >> "$RESULTS"
+run_case prefork "$BUILD/example_serv -P 4 PORT" -n -e 18 -c 16 "$@" >> "$RESULTS"
+run_case epoll "$BUILD/linux_sock_server_multi -p PORT" "$@" >> "$RESULTS"
+run_case epoll-pool "$BUILD/linux_sock_server_multi -p PORT -w 0" "$@" >> "$RESULTS"
+run_case per-core "$BUILD/linux_sock_server_multi -p PORT -c 0" "$@" >> "$RESULTS"
+run_case acceptor-handoff "$BUILD/linux_sock_server_multi -p PORT -a 0" "$@" >> "$RESULTS"
+run_case io_uring "$BUILD/linux_sock_server_multi -p PORT -b uring" "$@" >> "$RESULTS"
+run_case framed "$BUILD/linux_sock_server_multi -p PORT -f" -f "$@" >> "$RESULTS"
+run_case delimited "$BUILD/linux_sock_server_multi -p PORT -l nl" -l "$@" >> "$RESULTS"
+run_case coroutines "$BUILD/coro_echo_server -p PORT" "$@" >> "$RESULTS"
+run_case http "$BUILD/http_server -p PORT" -H / "$@" >> "$RESULTS"
+
+awk -F, '{ printf "%-16s %10s %9s %9s %9s %10s %11s %7s\n", $1, $2, $3, $4, $5, $6, $7, $8 }' "$RESULTS"
@@ -0,0 +1,246 @@
+// Shared-memory message channel, see shm_ring.h
+//
+// Mapping: a page with the two control blocks, then the client-to-server ring and the
+// server-to-client ring. A message is a 32-bit length and the bytes, padded to 8; one
+// that does not fit before the end of the ring is preceded by a wrap marker that sends
+// the reader back to the start, so every message is contiguous in memory.
+#define _GNU_SOURCE // memfd_create
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "shm_ring.h"
+
+#define CTL_SPACE 4096
+#define MAP_SIZE (CTL_SPACE + 2 * SHM_RING_SIZE)
+#define MASK (SHM_RING_SIZE - 1)
+#define WRAP 0xffffffffu
+#define REC_SIZE(len) (((uint32_t)(len) + 4 + 7) & ~7u)
+
+// Ring 0 carries client to server, ring 1 server to client
+static int map_rings(struct shm_channel *ch, int server)
+{
+    unsigned char *base = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ch->memfd, 0);
+    struct shm_ring r[2];
+
+    if (base == MAP_FAILED)
+        return -1;
+    ch->map = base;
+    for (int i = 0; i < 2; i++)
+    {
+        r[i].ctl = (struct shm_ctl *)(base + i * 256);
+        r[i].data = base + CTL_SPACE + i * SHM_RING_SIZE;
+        r[i].pending = 0;
+    }
+    ch->tx = r[server ? 1 : 0];
+    ch->rx = r[server ? 0 : 1];
+    // Both rings start at 0. The server never takes its positions from the mapping:
+    // a client could have left them unaligned, and an unaligned position would put the
+    // server's next write past the end of the ring. What a client sent before we got
+    // here is still read from 0, with the usual checks on its tail.
+    ch->tx.pos = ch->rx.pos = 0;
+    if (server)
+    {
+        __atomic_store_n(&ch->tx.ctl->head, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&ch->tx.ctl->tail, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&ch->rx.ctl->head, 0, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+int shm_channel_create(struct shm_channel *ch)
+{
+    memset(ch, 0, sizeof(*ch));
+    ch->event_fd = ch->peer_fd = -1;
+    if ((ch->memfd = memfd_create("shm_channel", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+        return -1;
+    // sealed, so the server can rely on the size: a client that could shrink the file
+    // would make the server's next access to the mapping fault
+    if (ftruncate(ch->memfd, MAP_SIZE) < 0 ||
+        fcntl(ch->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+        (ch->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (ch->peer_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || map_rings(ch, 0) < 0)
+    {
+        int saved = errno;
+        shm_channel_close(ch);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+static int make_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int shm_channel_attach(struct shm_channel *ch, int memfd, int event_fd, int peer_fd)
+{
+    struct stat st;
+    int seals;
+
+    memset(ch, 0, sizeof(*ch));
+    ch->memfd = memfd;
+    ch->event_fd = event_fd;
+    ch->peer_fd = peer_fd;
+    // the client chose the wakeup fds: whatever they are, shm_wake and shm_notify must
+    // never block on them
+    if (fstat(memfd, &st) < 0 || (seals = fcntl(memfd, F_GET_SEALS)) < 0 || st.st_size != MAP_SIZE ||
+        !(seals & F_SEAL_SHRINK) || make_nonblocking(event_fd) < 0 || make_nonblocking(peer_fd) < 0)
+    {
+        shm_channel_close(ch);
+        errno = EPROTO;
+        return -1;
+    }
+    if (map_rings(ch, 1) < 0)
+    {
+        int saved = errno;
+        shm_channel_close(ch);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+void shm_channel_close(struct shm_channel *ch)
+{
+    if (ch->map != NULL)
+        munmap(ch->map, MAP_SIZE);
+    if (ch->memfd >= 0)
+        close(ch->memfd);
+    if (ch->event_fd >= 0)
+        close(ch->event_fd);
+    if (ch->peer_fd >= 0)
+        close(ch->peer_fd);
+    ch->map = NULL;
+    ch->memfd = ch->event_fd = ch->peer_fd = -1;
+}
+
+int shm_send(struct shm_channel *ch, const void *a, size_t alen, const void *b, size_t blen)
+{
+    struct shm_ring *r = &ch->tx;
+    size_t len = alen + blen;
+    uint32_t need, skip, off, head;
+
+    if (len > SHM_MSG_MAX)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    need = REC_SIZE(len);
+    off = r->pos & MASK;
+    skip = SHM_RING_SIZE - off < need ? SHM_RING_SIZE - off : 0; // wrap first
+    head = __atomic_load_n(&r->ctl->head, __ATOMIC_ACQUIRE);
+    if (SHM_RING_SIZE - (r->pos - head) < skip + need)
+    {
+        // full: ask to be woken when the consumer makes room, then look again in case
+        // it did just now
+        __atomic_store_n(&r->ctl->producer_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&r->ctl->head, __ATOMIC_ACQUIRE);
+        if (SHM_RING_SIZE - (r->pos - head) < skip + need)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        __atomic_store_n(&r->ctl->producer_waiting, 0, __ATOMIC_RELAXED);
+    }
+    if (skip > 0)
+    {
+        *(uint32_t *)(r->data + off) = WRAP;
+        r->pos += skip;
+        off = 0;
+    }
+    *(uint32_t *)(r->data + off) = (uint32_t)len;
+    memcpy(r->data + off + 4, a, alen);
+    memcpy(r->data + off + 4 + alen, b, blen);
+    r->pos += need;
+    __atomic_store_n(&r->ctl->tail, r->pos, __ATOMIC_RELEASE);
+    ch->sent++;
+    return 0;
+}
+
+int shm_recv(struct shm_channel *ch, const unsigned char **msg, size_t *len)
+{
+    struct shm_ring *r = &ch->rx;
+    uint32_t tail = __atomic_load_n(&r->ctl->tail, __ATOMIC_ACQUIRE);
+
+    while (1)
+    {
+        uint32_t avail = tail - r->pos, off = r->pos & MASK, n;
+
+        if (avail == 0)
+            return 0;
+        // read the length once: the peer may change it under us, but not our checks
+        n = __atomic_load_n((uint32_t *)(r->data + off), __ATOMIC_RELAXED);
+        if (n == WRAP && SHM_RING_SIZE - off <= avail)
+        {
+            r->pos += SHM_RING_SIZE - off;
+            continue;
+        }
+        if (avail > SHM_RING_SIZE || (avail & 7) || n > SHM_MSG_MAX || REC_SIZE(n) > avail ||
+            off + REC_SIZE(n) > SHM_RING_SIZE)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        *msg = r->data + off + 4;
+        *len = n;
+        r->pending = REC_SIZE(n);
+        return 1;
+    }
+}
+
+void shm_consume(struct shm_channel *ch)
+{
+    struct shm_ring *r = &ch->rx;
+
+    r->pos += r->pending;
+    r->pending = 0;
+    __atomic_store_n(&r->ctl->head, r->pos, __ATOMIC_RELEASE);
+}
+
+void shm_notify(struct shm_channel *ch)
+{
+    uint64_t one = 1;
+    int wake = 0;
+
+    // pairs with the fence in shm_prepare_sleep / shm_send: either the peer sees what
+    // we published, or we see that it is waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ch->sent > 0 && __atomic_exchange_n(&ch->tx.ctl->consumer_waiting, 0, __ATOMIC_RELAXED))
+        wake = 1;
+    if (__atomic_load_n(&ch->rx.ctl->producer_waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&ch->rx.ctl->producer_waiting, 0, __ATOMIC_RELAXED))
+        wake = 1;
+    ch->sent = 0;
+    if (wake && write(ch->peer_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return; // the peer is gone; its hang-up is noticed elsewhere
+}
+
+int shm_prepare_sleep(struct shm_channel *ch)
+{
+    __atomic_store_n(&ch->rx.ctl->consumer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ch->rx.ctl->tail, __ATOMIC_ACQUIRE) != ch->rx.pos)
+    {
+        __atomic_store_n(&ch->rx.ctl->consumer_waiting, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void shm_wake(struct shm_channel *ch)
+{
+    uint64_t n;
+
+    __atomic_store_n(&ch->rx.ctl->consumer_waiting, 0, __ATOMIC_RELAXED);
+    while (read(ch->event_fd, &n, sizeof(n)) < 0 && errno == EINTR)
+        ;
+}
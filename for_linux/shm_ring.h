@@ -0,0 +1,85 @@
+// Shared-memory message channel for clients on the same host.
+//
+// A channel is one memfd holding two single-producer single-consumer rings, client to
+// server and server to client, mapped by both processes. A message is copied straight
+// into the ring and read in place by the other side: no syscall, no socket buffer, no
+// TCP stack. The messages are frames (frame.h), as on the sockets.
+//
+// Each side has an eventfd the other writes to wake it, but only once the sleeper has
+// announced in the shared control block that it is about to block and then found
+// nothing to do (the futex protocol, with an fd so the server can wait in epoll). A
+// consumer that keeps up is never interrupted, and a producer talking to a busy
+// consumer makes no syscalls at all.
+//
+// The peer is not trusted: every position and length read from shared memory is
+// checked before use, and a corrupt ring only fails the channel.
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_SIZE (256 * 1024) // bytes of messages per direction, a power of two
+#define SHM_MSG_MAX (SHM_RING_SIZE / 4)
+#define SHM_MAGIC 0x53484d31 // "SHM1", first word of the setup message
+
+// Control block of one ring, in the shared mapping
+struct shm_ctl
+{
+    uint32_t head __attribute__((aligned(64))); // consumer: next byte to read
+    uint32_t consumer_waiting;                   // consumer is going to sleep
+    uint32_t tail __attribute__((aligned(64))); // producer: next byte to write
+    uint32_t producer_waiting;                   // producer found the ring full
+};
+
+struct shm_ring
+{
+    struct shm_ctl *ctl;
+    unsigned char *data;
+    uint32_t pos;     // our own end of the ring (tail for tx, head for rx), never read back
+    uint32_t pending; // rx: size of the message shm_recv returned
+};
+
+struct shm_channel
+{
+    struct shm_ring tx; // we produce
+    struct shm_ring rx; // we consume
+    int event_fd;       // ours: the peer writes it when rx has data or tx has room
+    int peer_fd;        // the peer's
+    int memfd;
+    void *map;
+    int sent;           // messages sent since the last shm_notify
+};
+
+// Client: create a channel. Hand memfd, peer_fd and event_fd, in that order, to the
+// server (fd_send), which attaches with the same three. Returns 0, or -1 with errno.
+int shm_channel_create(struct shm_channel *ch);
+
+// Server: map the channel a client created. Takes ownership of the three fds, even on
+// failure, and makes the two eventfds non-blocking whatever the client passed. Returns
+// 0, or -1 with errno (EPROTO if the memfd is not a sealed channel).
+int shm_channel_attach(struct shm_channel *ch, int memfd, int event_fd, int peer_fd);
+
+void shm_channel_close(struct shm_channel *ch);
+
+// Queue one message made of a and b. Returns 0, or -1 with errno = EAGAIN when the ring
+// is full (the peer wakes us once it has made room) or EMSGSIZE.
+int shm_send(struct shm_channel *ch, const void *a, size_t alen, const void *b, size_t blen);
+
+// The next message, left in place: 1 with *msg and *len set, 0 if there is none, or -1
+// with errno = EPROTO if the peer corrupted the ring. Release it with shm_consume.
+int shm_recv(struct shm_channel *ch, const unsigned char **msg, size_t *len);
+void shm_consume(struct shm_channel *ch);
+
+// After a batch of sends and consumes: wake the peer if it is asleep waiting for what
+// we sent or for the room we made
+void shm_notify(struct shm_channel *ch);
+
+// Before blocking on event_fd: announce it, then look once more. Returns 1 if the
+// caller may block, or 0 if there is work after all (no need to block).
+int shm_prepare_sleep(struct shm_channel *ch);
+
+// On waking (or instead of blocking): clear the announcement and the eventfd
+void shm_wake(struct shm_channel *ch);
+
+#endif
@@ -0,0 +1,183 @@
+// Fixed-size worker thread pool, see thread_pool.h
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+#include "buf_pool.h"
+
+struct task
+{
+    task_fn fn;
+    void *arg;
+};
+
+struct thread_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+
+    struct task *queue; // ring buffer of queue_capacity entries
+    int capacity;
+    int head;           // next task to run
+    int count;          // tasks in the ring
+    int peak;
+    int busy;
+    int shutdown;
+
+    uint64_t submitted;
+    uint64_t rejected;
+    uint64_t completed;
+    uint64_t busy_ns;   // summed run time of finished tasks
+    uint64_t start_ns;
+
+    int nthreads;
+    pthread_t *threads;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *worker_main(void *arg)
+{
+    struct thread_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (pool->count == 0 && !pool->shutdown)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        if (pool->count == 0 && pool->shutdown)
+            break;
+
+        struct task t = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pool->busy++;
+        pthread_mutex_unlock(&pool->lock);
+
+        uint64_t t0 = now_ns();
+        t.fn(t.arg);
+        uint64_t t1 = now_ns();
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy--;
+        pool->completed++;
+        pool->busy_ns += t1 - t0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    buf_pool_thread_flush(); // tasks freed blocks into this thread's cache
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(int nthreads, int queue_capacity)
+{
+    struct thread_pool *pool;
+
+    if (nthreads <= 0)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (int)ncpu : 1;
+    }
+    if (queue_capacity <= 0)
+        queue_capacity = 1024 * nthreads;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    pool->queue = calloc(queue_capacity, sizeof(*pool->queue));
+    pool->threads = calloc(nthreads, sizeof(*pool->threads));
+    if (pool->queue == NULL || pool->threads == NULL)
+        goto fail;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pool->capacity = queue_capacity;
+    pool->start_ns = now_ns();
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        int rc = pthread_create(&pool->threads[i], NULL, worker_main, pool);
+        if (rc != 0)
+        {
+            thread_pool_destroy(pool);
+            errno = rc;
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+
+fail:
+    free(pool->queue);
+    free(pool->threads);
+    free(pool);
+    errno = ENOMEM;
+    return NULL;
+}
+
+int thread_pool_submit(struct thread_pool *pool, task_fn fn, void *arg)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count == pool->capacity || pool->shutdown)
+    {
+        pool->rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int tail = (pool->head + pool->count) % pool->capacity;
+    pool->queue[tail].fn = fn;
+    pool->queue[tail].arg = arg;
+    pool->count++;
+    pool->submitted++;
+    if (pool->count > pool->peak)
+        pool->peak = pool->count;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void thread_pool_stats(struct thread_pool *pool, struct thread_pool_stats *out)
+{
+    uint64_t elapsed = now_ns() - pool->start_ns;
+
+    pthread_mutex_lock(&pool->lock);
+    out->nthreads = pool->nthreads;
+    out->busy = pool->busy;
+    out->queue_depth = pool->count;
+    out->queue_capacity = pool->capacity;
+    out->queue_peak = pool->peak;
+    out->submitted = pool->submitted;
+    out->rejected = pool->rejected;
+    out->completed = pool->completed;
+    out->utilisation = (elapsed && pool->nthreads) ? (double)pool->busy_ns / ((double)elapsed * pool->nthreads) : 0.0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->queue);
+    free(pool->threads);
+    free(pool);
+}
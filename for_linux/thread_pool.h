@@ -0,0 +1,41 @@
+// Fixed-size worker thread pool with a bounded FIFO task queue.
+//
+// Workers are started once and live until thread_pool_destroy(); submitting work
+// never creates a thread. When the queue is full thread_pool_submit() fails with
+// EAGAIN and the caller decides what to do (run inline, drop, retry later).
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+
+typedef void (*task_fn)(void *arg);
+
+struct thread_pool;
+
+// Snapshot returned by thread_pool_stats()
+struct thread_pool_stats
+{
+    int nthreads;             // number of workers
+    int busy;                 // workers running a task right now
+    int queue_depth;          // tasks waiting in the queue
+    int queue_capacity;       // maximum queue length
+    int queue_peak;           // deepest the queue has been since creation
+    uint64_t submitted;       // tasks accepted by thread_pool_submit
+    uint64_t rejected;        // submits that failed because the queue was full
+    uint64_t completed;       // tasks that have finished
+    double utilisation;       // busy time / (wall time * nthreads) since creation, 0..1
+};
+
+// nthreads <= 0 means one worker per online CPU. queue_capacity <= 0 picks 1024 * nthreads.
+// Returns NULL and sets errno on failure.
+struct thread_pool *thread_pool_create(int nthreads, int queue_capacity);
+
+// Queue fn(arg). Returns 0, or -1 with errno = EAGAIN when the queue is full.
+int thread_pool_submit(struct thread_pool *pool, task_fn fn, void *arg);
+
+void thread_pool_stats(struct thread_pool *pool, struct thread_pool_stats *out);
+
+// Run the tasks already queued, then join and free every worker
+void thread_pool_destroy(struct thread_pool *pool);
+
+#endif
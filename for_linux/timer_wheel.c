@@ -0,0 +1,170 @@
+// Hierarchical hashed timer wheel, see timer_wheel.h
+//
+// A timer with d ms to go lives on level l where 64^l <= d < 64^(l+1), in the slot
+// picked by bits [6l, 6l+6) of its expiry time. That slot is revisited exactly when
+// the clock reaches the expiry rounded down to a multiple of 64^l; its timers are
+// then re-filed by their (now smaller) remaining time, and level 0 slots fire.
+#include <stdlib.h>
+
+#include "timer_wheel.h"
+
+#define LEVELS 6
+#define BITS 6
+#define SLOTS (1 << BITS)
+#define MASK (SLOTS - 1)
+#define MAX_DELAY ((1ull << (BITS * LEVELS)) - 1)
+
+struct timer_wheel
+{
+    uint64_t now;                     // last tick processed
+    uint64_t bitmap[LEVELS];          // bit s set when slots[l][s] is non-empty
+    struct timer *slots[LEVELS][SLOTS];
+};
+
+void timer_init(struct timer *t, timer_cb cb, void *arg)
+{
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->slot = -1;
+    t->cb = cb;
+    t->arg = arg;
+}
+
+struct timer_wheel *timer_wheel_create(uint64_t now_ms)
+{
+    struct timer_wheel *w = calloc(1, sizeof(*w));
+
+    if (w != NULL)
+        w->now = now_ms;
+    return w;
+}
+
+void timer_wheel_destroy(struct timer_wheel *w)
+{
+    free(w);
+}
+
+static void unlink_timer(struct timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next != NULL)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// File t by its remaining time; t->expires >= w->now
+static void place(struct timer_wheel *w, struct timer *t)
+{
+    uint64_t delta = t->expires - w->now;
+    int l = 0, s;
+
+    if (delta > MAX_DELAY)
+    {
+        t->expires = w->now + MAX_DELAY;
+        delta = MAX_DELAY;
+    }
+    while (l < LEVELS - 1 && delta >= 1ull << (BITS * (l + 1)))
+        l++;
+    s = (int)(t->expires >> (BITS * l)) & MASK;
+
+    struct timer **head = &w->slots[l][s];
+    t->next = *head;
+    if (t->next != NULL)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    t->slot = l * SLOTS + s;
+    w->bitmap[l] |= 1ull << s;
+}
+
+void timer_wheel_add(struct timer_wheel *w, struct timer *t, uint64_t expires_ms)
+{
+    if (timer_pending(t))
+        timer_wheel_del(w, t);
+    t->expires = expires_ms > w->now ? expires_ms : w->now + 1;
+    place(w, t);
+}
+
+void timer_wheel_del(struct timer_wheel *w, struct timer *t)
+{
+    int l = t->slot / SLOTS, s = t->slot % SLOTS;
+
+    if (!timer_pending(t))
+        return;
+    unlink_timer(t);
+    if (w->slots[l][s] == NULL)
+        w->bitmap[l] &= ~(1ull << s);
+}
+
+uint64_t timer_wheel_next(const struct timer_wheel *w)
+{
+    uint64_t best = UINT64_MAX;
+
+    for (int l = 0; l < LEVELS; l++)
+    {
+        uint64_t b = w->bitmap[l];
+        if (b == 0)
+            continue;
+
+        // distance (1..64) from the current slot to the next occupied one
+        uint64_t cur = w->now >> (BITS * l);
+        int shift = (int)((cur + 1) & MASK);
+        uint64_t rot = shift ? (b >> shift) | (b << (SLOTS - shift)) : b;
+        uint64_t at = (cur + __builtin_ctzll(rot) + 1) << (BITS * l);
+
+        if (at < best)
+            best = at;
+    }
+    return best;
+}
+
+// Take the whole list out of a slot; the returned head's pprev points at *list
+static void detach(struct timer_wheel *w, int l, int s, struct timer **list)
+{
+    *list = w->slots[l][s];
+    w->slots[l][s] = NULL;
+    w->bitmap[l] &= ~(1ull << s);
+    if (*list != NULL)
+        (*list)->pprev = list;
+}
+
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now_ms)
+{
+    struct timer *list;
+
+    while (w->now < now_ms)
+    {
+        uint64_t tick = timer_wheel_next(w);
+        if (tick > now_ms)
+        {
+            w->now = now_ms;
+            break;
+        }
+        w->now = tick;
+
+        // Move timers down from every level whose period starts at this tick,
+        // highest first so they can cascade all the way to level 0
+        for (int l = LEVELS - 1; l >= 1; l--)
+        {
+            if ((tick & ((1ull << (BITS * l)) - 1)) != 0)
+                continue;
+            detach(w, l, (int)(tick >> (BITS * l)) & MASK, &list);
+            while (list != NULL)
+            {
+                struct timer *t = list;
+                unlink_timer(t);
+                place(w, t);
+            }
+        }
+
+        detach(w, 0, (int)tick & MASK, &list);
+        while (list != NULL)
+        {
+            struct timer *t = list;
+            unlink_timer(t);
+            t->cb(t, t->arg);
+        }
+    }
+}
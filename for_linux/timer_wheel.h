@@ -0,0 +1,52 @@
+// Hierarchical hashed timer wheel with 1 ms ticks.
+//
+// Six levels of 64 slots cover 2^36 ms (about two years); a timer sits in the level
+// whose span holds its remaining time and moves down a level each time its slot comes
+// round. Adding and deleting are O(1) list operations on a struct timer embedded in
+// the caller's own state, and a per-level occupancy bitmap lets timer_wheel_next()
+// find the next tick with work in O(levels), so the owner can sleep until then and
+// pending timers cost nothing until they are due.
+//
+// Not thread-safe: a wheel belongs to one thread (see event_loop_timer_add).
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+struct timer;
+typedef void (*timer_cb)(struct timer *t, void *arg);
+
+struct timer
+{
+    struct timer *next;
+    struct timer **pprev; // NULL while the timer is not scheduled
+    uint64_t expires;     // absolute time in ms
+    int slot;             // level * 64 + slot index while scheduled
+    timer_cb cb;
+    void *arg;
+};
+
+struct timer_wheel;
+
+void timer_init(struct timer *t, timer_cb cb, void *arg);
+static inline int timer_pending(const struct timer *t) { return t->pprev != NULL; }
+
+// now_ms is the current time on whatever millisecond clock the owner uses
+struct timer_wheel *timer_wheel_create(uint64_t now_ms);
+void timer_wheel_destroy(struct timer_wheel *w);
+
+// Schedule t to fire at expires_ms (re-scheduling it if already pending). Times that
+// are already past fire on the next tick.
+void timer_wheel_add(struct timer_wheel *w, struct timer *t, uint64_t expires_ms);
+// Cancel t; nothing happens if it is not pending
+void timer_wheel_del(struct timer_wheel *w, struct timer *t);
+
+// Earliest time at which timer_wheel_advance has work to do (a timer to fire or one to
+// move down a level), or UINT64_MAX when no timer is pending
+uint64_t timer_wheel_next(const struct timer_wheel *w);
+
+// Run every timer due by now_ms. Callbacks may add and delete timers, including
+// themselves and others that are due in the same call.
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now_ms);
+
+#endif
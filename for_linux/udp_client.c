@@ -0,0 +1,219 @@
+// Batched UDP echo client for linux_sock_server_multi -u.
+//
+// Every thread owns a connected UDP socket and keeps up to window datagrams in flight,
+// sending them with sendmmsg() and collecting the echoes with recvmmsg(), batch at a
+// time. -b 1 uses one send()/recv() per datagram instead, the per-packet baseline.
+// Datagrams whose echo does not arrive within 10 ms of the window filling up are
+// counted as lost.
+// Build: gcc -O2 -o udp_client udp_client.c -lpthread
+//
+// Usage: udp_client [-h host] [-p port] [-t threads] [-d secs] [-s size] [-b batch] [-w window]
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TRUE 1
+#define FALSE 0
+#define PORT 8888
+#define MAX_BATCH 64
+#define MAX_DGRAM 2048
+#define LOSS_TIMEOUT_MS 10
+
+struct worker
+{
+    pthread_t thread;
+    int fd;
+    long sent;
+    long received;
+    long lost;
+} __attribute__((aligned(64)));
+
+static struct sockaddr_in server;
+static int batch = 32;
+static int window = 256;
+static size_t size = 64;
+static double duration = 5;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct mmsghdr smsg[MAX_BATCH], rmsg[MAX_BATCH];
+    struct iovec siov[MAX_BATCH], riov[MAX_BATCH];
+    char (*rbuf)[MAX_DGRAM] = malloc(MAX_BATCH * MAX_DGRAM); // reused for every batch
+    char *payload = malloc(size);
+    int inflight = 0;
+    double end = now() + duration;
+
+    memset(payload, 'u', size);
+    memset(smsg, 0, sizeof(smsg));
+    memset(rmsg, 0, sizeof(rmsg));
+    for (int i = 0; i < MAX_BATCH; i++)
+    {
+        siov[i].iov_base = payload; // every datagram carries the same bytes
+        siov[i].iov_len = size;
+        smsg[i].msg_hdr.msg_iov = &siov[i];
+        smsg[i].msg_hdr.msg_iovlen = 1;
+        riov[i].iov_base = rbuf[i];
+        riov[i].iov_len = MAX_DGRAM;
+        rmsg[i].msg_hdr.msg_iov = &riov[i];
+        rmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (now() < end)
+    {
+        int room = window - inflight, n;
+
+        if (room > 0)
+        {
+            n = room < batch ? room : batch;
+            if (batch == 1)
+                n = send(w->fd, payload, size, MSG_DONTWAIT) < 0 ? -1 : 1;
+            else
+                n = sendmmsg(w->fd, smsg, n, MSG_DONTWAIT);
+            if (n > 0)
+            {
+                w->sent += n;
+                inflight += n;
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED)
+            {
+                perror("send");
+                break;
+            }
+        }
+
+        if (batch == 1)
+            n = recv(w->fd, rbuf[0], MAX_DGRAM, MSG_DONTWAIT) < 0 ? -1 : 1;
+        else
+            n = recvmmsg(w->fd, rmsg, batch, MSG_DONTWAIT, NULL);
+        if (n > 0)
+        {
+            w->received += n;
+            inflight -= n;
+            if (inflight < 0)
+                inflight = 0; // late echoes of datagrams already written off
+            continue;
+        }
+        if (inflight < window)
+            continue;
+
+        // window full and nothing to read: wait a little, then write the window off
+        struct pollfd pfd = {w->fd, POLLIN, 0};
+        if (poll(&pfd, 1, LOSS_TIMEOUT_MS) == 0)
+        {
+            w->lost += inflight;
+            inflight = 0;
+        }
+    }
+    free(payload);
+    free(rbuf);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int port = PORT, nthreads = 1, opt;
+    struct worker *workers;
+    long sent = 0, received = 0, lost = 0;
+    double start, elapsed;
+
+    while ((opt = getopt(argc, argv, "h:p:t:d:s:b:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 's': size = (size_t)atol(optarg); break;
+        case 'b': batch = atoi(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-t threads] [-d secs] [-s size] [-b batch] [-w window]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (batch < 1)
+        batch = 1;
+    if (batch > MAX_BATCH)
+        batch = MAX_BATCH;
+    if (window < batch)
+        window = batch;
+    if (size < 1 || size > MAX_DGRAM)
+    {
+        fprintf(stderr, "size must be 1..%d\n", MAX_DGRAM);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", host);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((workers = aligned_alloc(64, nthreads * sizeof(*workers))) == NULL)
+    {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(workers, 0, nthreads * sizeof(*workers));
+
+    start = now();
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct worker *w = &workers[i];
+        // a connected socket only sees datagrams from the server and needs no address per send
+        if ((w->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+            connect(w->fd, (struct sockaddr *)&server, sizeof(server)) < 0)
+        {
+            perror("socket");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].fd);
+        sent += workers[i].sent;
+        received += workers[i].received;
+        lost += workers[i].lost;
+    }
+    elapsed = now() - start;
+
+    printf("%d threads, %zu byte datagrams, %s, window %d\n", nthreads, size,
+           batch == 1 ? "one syscall per datagram" : "batched", window);
+    if (batch > 1)
+        printf("batch %d datagrams per sendmmsg/recvmmsg\n", batch);
+    printf("sent %ld, echoed %ld, lost %ld (%.2f%%)\n", sent, received, lost,
+           sent ? 100.0 * lost / sent : 0.0);
+    printf("throughput %.0f datagrams/s sent, %.0f echoed/s (%.0f per thread)\n",
+           sent / elapsed, received / elapsed, received / elapsed / nthreads);
+    free(workers);
+    return 0;
+}
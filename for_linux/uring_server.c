@@ -0,0 +1,720 @@
+// io_uring echo backend, see uring_server.h. Talks to the kernel through the raw
+// io_uring_setup/enter/register syscalls, so it does not need liburing.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+
+#include "uring_server.h"
+#include "log.h"
+
+#define QUEUE_DEPTH 4096   // submission queue entries
+#define NUM_BUFS 4096      // provided receive buffers, must be a power of two
+#define BUF_SIZE 4096      // bytes per provided buffer
+#define BUF_GROUP 1        // buffer group id of the provided ring
+#define MAX_CHAIN 16       // sends linked into one chain
+#define MAX_PEND 64        // buffers one connection may hold before its recv is paused
+
+// user_data layout: type (4 bits) | buffer id (16) | generation (12) | fd (32)
+enum
+{
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_SIGNAL,
+    OP_CANCEL,
+};
+#define UD(type, bid, gen, fd) (((uint64_t)(type) << 60) | ((uint64_t)(bid) << 44) | ((uint64_t)((gen) & 0xfff) << 32) | (uint32_t)(fd))
+#define UD_TYPE(ud) ((int)((ud) >> 60))
+#define UD_BID(ud) ((int)(((ud) >> 44) & 0xffff))
+#define UD_GEN(ud) ((unsigned)(((ud) >> 32) & 0xfff))
+#define UD_FD(ud) ((int)(uint32_t)(ud))
+
+struct ring
+{
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_local_tail; // includes SQEs prepared but not yet published
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqes_sz;
+};
+
+// Per-connection state, indexed by fd
+struct uconn
+{
+    unsigned gen;      // bumped on every accept so late completions for a reused fd are ignored
+    int open;
+    int closing;       // peer sent EOF, close once queued echoes are out
+    int want_recv;     // recv ran out of provided buffers, re-arm when some come back
+    int in_dirty;      // on the flush list (survives close/accept, like the list entry)
+    int in_stalled;    // on the stalled list
+    int inflight;      // sends submitted and not yet completed
+    int pend_head;     // received buffers waiting to be echoed, linked through bid_next
+    int pend_tail;
+    int npend;         // buffers held, queued or in flight
+    int recv_armed;    // a multishot recv is active in the kernel
+    int recv_paused;   // npend reached MAX_PEND: recv is cancelled until the sends drain
+};
+
+struct server
+{
+    struct ring ring;
+    int listener;
+    int sigfd;
+    struct signalfd_siginfo siginfo;
+
+    struct io_uring_buf_ring *br;
+    unsigned br_tail;
+    char *bufs;                // NUM_BUFS * BUF_SIZE
+    int bid_next[NUM_BUFS];
+    int bid_len[NUM_BUFS];
+
+    struct uconn *conns;
+    int nconns;
+    int *dirty;                // fds with pending echoes and nothing in flight
+    int ndirty;
+    int *stalled;              // fds waiting for provided buffers
+    int nstalled;
+    int recycled;              // buffers were returned since the stalled list was last checked
+    int rearm_accept;          // no SQE was free to re-arm the listener: retry each pass
+    int rearm_signal;          // same for the signalfd watch
+
+    unsigned long long enters, completions, bytes, accepted;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_supported(void)
+{
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    int fd, ok = 0;
+    size_t len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+
+    memset(&p, 0, sizeof(p));
+    if ((fd = sys_io_uring_setup(4, &p)) < 0)
+        return 0;
+
+    // Multishot recv and provided buffer rings have no probe bit of their own; SEND_ZC
+    // arrived in the same release (6.0), so its presence stands in for both.
+    if ((probe = calloc(1, len)) != NULL && sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+        ok = probe->last_op >= IORING_OP_SEND_ZC && (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    close(fd);
+    return ok;
+}
+
+static int ring_init(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    if ((r->fd = sys_io_uring_setup(entries, &p)) < 0)
+    {
+        memset(&p, 0, sizeof(p));
+        if ((r->fd = sys_io_uring_setup(entries, &p)) < 0)
+            return -1;
+    }
+
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_sz > r->sq_sz)
+            r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        return -1;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else
+    {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            return -1;
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+
+    // SQ slot i always holds SQE i
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        r->sq_array[i] = i;
+    return 0;
+}
+
+static void ring_free(struct ring *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_sz);
+    if (r->fd >= 0)
+        close(r->fd);
+}
+
+static unsigned sq_space(struct ring *r)
+{
+    return r->sq_entries - (r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+// Publish prepared SQEs and enter the kernel, optionally waiting for one completion
+static int ring_submit(struct server *s, unsigned wait)
+{
+    struct ring *r = &s->ring;
+    unsigned to_submit;
+    int rc;
+
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    to_submit = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait == 0)
+        return 0;
+
+    s->enters++;
+    rc = sys_io_uring_enter(r->fd, to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    if (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        return 0;
+    return rc < 0 ? -1 : 0;
+}
+
+static struct io_uring_sqe *get_sqe(struct server *s)
+{
+    struct ring *r = &s->ring;
+    struct io_uring_sqe *sqe;
+
+    if (sq_space(r) == 0)
+    {
+        ring_submit(s, 0);
+        if (sq_space(r) == 0)
+            return NULL;
+    }
+    sqe = &r->sqes[r->sq_local_tail & *r->sq_mask];
+    r->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Hand a receive buffer back to the kernel's provided buffer ring
+static void buf_recycle(struct server *s, int bid)
+{
+    struct io_uring_buf *b = &s->br->bufs[s->br_tail & (NUM_BUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(s->bufs + (size_t)bid * BUF_SIZE);
+    b->len = BUF_SIZE;
+    b->bid = bid;
+    s->br_tail++;
+    s->recycled = 1;
+    __atomic_store_n(&s->br->tail, (uint16_t)s->br_tail, __ATOMIC_RELEASE);
+}
+
+static int setup_buffers(struct server *s)
+{
+    struct io_uring_buf_reg reg;
+
+    s->br = mmap(NULL, NUM_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (s->br == MAP_FAILED)
+        return -1;
+    if ((s->bufs = aligned_alloc(4096, (size_t)NUM_BUFS * BUF_SIZE)) == NULL)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)s->br;
+    reg.ring_entries = NUM_BUFS;
+    reg.bgid = BUF_GROUP;
+    if (sys_io_uring_register(s->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    s->br_tail = 0;
+    for (int i = 0; i < NUM_BUFS; i++)
+        buf_recycle(s, i);
+    return 0;
+}
+
+static struct uconn *conn_get(struct server *s, int fd)
+{
+    if (fd >= s->nconns)
+    {
+        int n = s->nconns ? s->nconns : 1024;
+        while (n <= fd)
+            n *= 2;
+        struct uconn *c = realloc(s->conns, n * sizeof(*c));
+        int *d = realloc(s->dirty, n * sizeof(*d));
+        if (d != NULL)
+            s->dirty = d;
+        int *st = realloc(s->stalled, n * sizeof(*st));
+        if (st != NULL)
+            s->stalled = st;
+        if (c == NULL || d == NULL || st == NULL)
+        {
+            if (c != NULL)
+                s->conns = c;
+            return NULL;
+        }
+        memset(c + s->nconns, 0, (n - s->nconns) * sizeof(*c));
+        s->conns = c;
+        s->nconns = n;
+    }
+    return &s->conns[fd];
+}
+
+// The arm_* functions return 0, or -1 when the submission queue is full even after
+// submitting what it holds; the caller must then try again later or give up the
+// connection, or nothing would ever complete for it again.
+static int arm_accept(struct server *s)
+{
+    struct io_uring_sqe *sqe = get_sqe(s);
+
+    if (sqe == NULL)
+    {
+        if (!s->rearm_accept)
+            log_warn("uring: submission queue full, accepting paused");
+        s->rearm_accept = 1;
+        return -1;
+    }
+    s->rearm_accept = 0;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = s->listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD(OP_ACCEPT, 0, 0, s->listener);
+    return 0;
+}
+
+static int arm_recv(struct server *s, int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe(s);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = UD(OP_RECV, 0, s->conns[fd].gen, fd);
+    s->conns[fd].recv_armed = 1;
+    return 0;
+}
+
+// Stop fd's multishot recv; its last completion comes back without IORING_CQE_F_MORE
+static int cancel_recv(struct server *s, int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe(s);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = UD(OP_RECV, 0, s->conns[fd].gen, fd);
+    sqe->user_data = UD(OP_CANCEL, 0, 0, fd);
+    return 0;
+}
+
+// Multishot poll on the signalfd; the signals themselves are read when it fires
+static int arm_signal(struct server *s)
+{
+    struct io_uring_sqe *sqe = get_sqe(s);
+
+    if (sqe == NULL)
+    {
+        s->rearm_signal = 1;
+        return -1;
+    }
+    s->rearm_signal = 0;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s->sigfd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = UD(OP_SIGNAL, 0, 0, s->sigfd);
+    return 0;
+}
+
+// Drop the connection now. Requests still in the kernel finish on their own and are
+// recognised as stale by the generation in their user_data.
+static void conn_close(struct server *s, int fd)
+{
+    struct uconn *c = &s->conns[fd];
+
+    while (c->pend_head >= 0)
+    {
+        int bid = c->pend_head;
+        c->pend_head = s->bid_next[bid];
+        buf_recycle(s, bid);
+    }
+    c->open = 0;
+    c->want_recv = 0;
+    c->gen++;
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+// Queue every pending buffer of fd as one chain of linked sends, so they reach the
+// socket in order even if one of them has to wait for buffer space. Returns 1 when
+// no SQE was free for the chain: fd then stays on the dirty list for the next pass,
+// since no send completion will come along to put it back.
+static int flush_conn(struct server *s, int fd)
+{
+    struct uconn *c = &s->conns[fd];
+    struct io_uring_sqe *prev = NULL;
+    int n = 0;
+
+    if (!c->open || c->inflight > 0)
+    {
+        c->in_dirty = 0;
+        return 0;
+    }
+    if (sq_space(&s->ring) < MAX_CHAIN)
+        ring_submit(s, 0);
+
+    while (c->pend_head >= 0 && n < MAX_CHAIN)
+    {
+        int bid = c->pend_head;
+        struct io_uring_sqe *sqe = get_sqe(s);
+        if (sqe == NULL)
+            break;
+        c->pend_head = s->bid_next[bid];
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)(s->bufs + (size_t)bid * BUF_SIZE);
+        sqe->len = s->bid_len[bid];
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL; // retry short sends in the kernel
+        sqe->user_data = UD(OP_SEND, bid, c->gen, fd);
+        if (prev != NULL)
+            prev->flags |= IOSQE_IO_LINK;
+        prev = sqe;
+        c->inflight++;
+        n++;
+    }
+    if (c->pend_head < 0)
+        c->pend_tail = -1;
+    if (n == 0 && c->pend_head >= 0)
+        return 1;
+    c->in_dirty = 0;
+    return 0;
+}
+
+static void mark_dirty(struct server *s, int fd)
+{
+    struct uconn *c = &s->conns[fd];
+
+    if (!c->in_dirty && c->inflight == 0)
+    {
+        c->in_dirty = 1;
+        s->dirty[s->ndirty++] = fd;
+    }
+}
+
+// fd's receive could not be re-armed: nothing more will be read from it, so echo what
+// is queued and close it, as at EOF
+static void recv_lost(struct server *s, int fd)
+{
+    struct uconn *c = &s->conns[fd];
+
+    log_warn("uring: submission queue full, closing connection %ld", (long)fd);
+    if (c->inflight > 0 || c->pend_head >= 0)
+    {
+        c->closing = 1;
+        mark_dirty(s, fd);
+    }
+    else
+        conn_close(s, fd);
+}
+
+// Re-arm a paused recv once fd's sends have caught up and the cancelled one is gone
+static void recv_resume(struct server *s, int fd)
+{
+    struct uconn *c = &s->conns[fd];
+
+    if (!c->recv_paused || c->recv_armed || c->closing || c->npend > MAX_PEND / 2)
+        return;
+    c->recv_paused = 0;
+    if (arm_recv(s, fd) < 0)
+        recv_lost(s, fd);
+}
+
+static void handle_accept(struct server *s, struct io_uring_cqe *cqe)
+{
+    int fd = cqe->res;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        arm_accept(s);
+    if (fd < 0)
+    {
+        if (fd != -EAGAIN && fd != -EINTR)
+            log_error("accept: errno %ld", (long)-fd);
+        return;
+    }
+
+    struct uconn *c = conn_get(s, fd);
+    if (c == NULL)
+    {
+        close(fd);
+        return;
+    }
+    c->gen++;
+    c->open = 1;
+    c->closing = c->want_recv = 0;
+    c->inflight = c->npend = 0;
+    c->recv_armed = c->recv_paused = 0;
+    c->pend_head = c->pend_tail = -1;
+    s->accepted++;
+    if (arm_recv(s, fd) < 0)
+        recv_lost(s, fd);
+}
+
+static void handle_recv(struct server *s, struct io_uring_cqe *cqe, int fd, unsigned gen)
+{
+    struct uconn *c = fd < s->nconns ? &s->conns[fd] : NULL;
+    int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    if (c == NULL || !c->open || (c->gen & 0xfff) != gen)
+    {
+        if (bid >= 0)
+            buf_recycle(s, bid);
+        return;
+    }
+
+    if (cqe->res > 0 && bid >= 0)
+    {
+        s->bytes += cqe->res;
+        s->bid_len[bid] = cqe->res;
+        s->bid_next[bid] = -1;
+        if (c->pend_tail >= 0)
+            s->bid_next[c->pend_tail] = bid;
+        else
+            c->pend_head = bid;
+        c->pend_tail = bid;
+        c->npend++;
+        mark_dirty(s, fd);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            c->recv_armed = 0;
+        if (c->npend >= MAX_PEND && !c->recv_paused)
+        {
+            // the peer is not reading its echoes: stop taking buffers everyone shares
+            if (!c->recv_armed || cancel_recv(s, fd) == 0)
+                c->recv_paused = 1;
+        }
+        if (c->recv_paused)
+            recv_resume(s, fd);
+        else if (!c->recv_armed && arm_recv(s, fd) < 0)
+            recv_lost(s, fd);
+        return;
+    }
+    c->recv_armed = 0;
+    if (c->recv_paused && (cqe->res == -ECANCELED || cqe->res == -ENOBUFS))
+    {
+        // the send side re-arms it once npend drops, unless that already happened
+        recv_resume(s, fd);
+        return;
+    }
+    if (cqe->res == -ENOBUFS)
+    {
+        // every buffer is queued for sending; try again once some are recycled
+        c->want_recv = 1;
+        if (!c->in_stalled)
+        {
+            c->in_stalled = 1;
+            s->stalled[s->nstalled++] = fd;
+        }
+        return;
+    }
+
+    // EOF or error: echo what is still queued, then close
+    if (cqe->res == 0 && (c->inflight > 0 || c->pend_head >= 0))
+        c->closing = 1;
+    else
+        conn_close(s, fd);
+}
+
+static void handle_send(struct server *s, struct io_uring_cqe *cqe, int fd, unsigned gen, int bid)
+{
+    struct uconn *c = fd < s->nconns ? &s->conns[fd] : NULL;
+    int len = s->bid_len[bid];
+
+    buf_recycle(s, bid);
+    if (c == NULL || !c->open || (c->gen & 0xfff) != gen)
+        return;
+
+    c->inflight--;
+    c->npend--;
+    if (cqe->res < len)
+    {
+        // error, or the rest of the chain was cancelled
+        conn_close(s, fd);
+        return;
+    }
+    if (c->inflight == 0)
+    {
+        if (c->pend_head >= 0)
+            mark_dirty(s, fd);
+        else if (c->closing)
+            conn_close(s, fd);
+    }
+    if (c->open)
+        recv_resume(s, fd);
+}
+
+static void handle_signal(struct server *s, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        arm_signal(s);
+    while (read(s->sigfd, &s->siginfo, sizeof(s->siginfo)) == sizeof(s->siginfo))
+    {
+        if (s->siginfo.ssi_signo != SIGUSR1)
+            continue;
+        printf("uring: %llu io_uring_enter calls, %llu completions (%.1f per call), %llu accepted, %llu bytes echoed\n",
+               s->enters, s->completions, s->enters ? (double)s->completions / s->enters : 0.0, s->accepted, s->bytes);
+        fflush(stdout);
+    }
+}
+
+static void reap(struct server *s)
+{
+    struct ring *r = &s->ring;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t ud = cqe->user_data;
+
+        switch (UD_TYPE(ud))
+        {
+        case OP_ACCEPT:
+            handle_accept(s, cqe);
+            break;
+        case OP_RECV:
+            handle_recv(s, cqe, UD_FD(ud), UD_GEN(ud));
+            break;
+        case OP_SEND:
+            handle_send(s, cqe, UD_FD(ud), UD_GEN(ud), UD_BID(ud));
+            break;
+        case OP_SIGNAL:
+            handle_signal(s, cqe);
+            break;
+        case OP_CANCEL:
+            break;
+        }
+        s->completions++;
+        head++;
+        if (head == tail)
+        {
+            // publish progress and look for completions that arrived meanwhile
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+            tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+int uring_server_run(int listener, int sigfd)
+{
+    struct server *s;
+
+    if ((s = calloc(1, sizeof(*s))) == NULL)
+        return -1;
+    s->ring.fd = -1;
+    s->listener = listener;
+    s->sigfd = sigfd;
+
+    if (ring_init(&s->ring, QUEUE_DEPTH) < 0 || setup_buffers(s) < 0 || conn_get(s, listener) == NULL)
+    {
+        int saved = errno;
+        ring_free(&s->ring);
+        free(s->bufs);
+        free(s);
+        errno = saved;
+        return -1;
+    }
+
+    arm_accept(s);
+    if (sigfd >= 0)
+        arm_signal(s);
+
+    while (1)
+    {
+        // multishot requests that ended while the submission queue was full
+        if (s->rearm_accept && arm_accept(s) == 0)
+            log_info("uring: accepting again");
+        if (s->rearm_signal)
+            arm_signal(s);
+
+        // chains for connections whose previous sends have all completed; those
+        // that found the submission queue full are kept for the next pass
+        int kept = 0;
+        for (int i = 0; i < s->ndirty; i++)
+            if (flush_conn(s, s->dirty[i]))
+                s->dirty[kept++] = s->dirty[i];
+        s->ndirty = kept;
+
+        // buffers came back, give starved receivers another go
+        if (s->nstalled > 0 && s->recycled)
+        {
+            for (int i = 0; i < s->nstalled; i++)
+            {
+                struct uconn *c = &s->conns[s->stalled[i]];
+                c->in_stalled = 0;
+                if (c->open && c->want_recv)
+                {
+                    c->want_recv = 0;
+                    if (arm_recv(s, s->stalled[i]) < 0)
+                        recv_lost(s, s->stalled[i]);
+                }
+            }
+            s->nstalled = 0;
+        }
+        s->recycled = 0;
+
+        // one syscall submits everything prepared above and waits for more work
+        if (ring_submit(s, 1) < 0)
+            return -1;
+        reap(s);
+    }
+    return 0;
+}
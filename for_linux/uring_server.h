@@ -0,0 +1,20 @@
+// io_uring echo backend, an alternative to the epoll reactor.
+//
+// One ring per loop. The listener is served by a single multishot accept, every
+// client by a single multishot recv that picks buffers from a kernel-provided buffer
+// ring, and echoes go out as chains of linked sends. A batch of completions for many
+// connections is handled per io_uring_enter() call instead of one recv() and one
+// send() syscall per message.
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+// Returns 1 when the running kernel has everything this backend needs (multishot
+// accept/recv and provided buffer rings, i.e. Linux 6.0+), 0 otherwise.
+int uring_supported(void);
+
+// Serve echo clients accepted on listener until a fatal error. When sigfd is not -1
+// every signal read from it prints the backend's syscall and completion counters.
+// Returns -1 with errno set on failure.
+int uring_server_run(int listener, int sigfd);
+
+#endif
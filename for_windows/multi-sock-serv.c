@@ -81,12 +81,12 @@ int main()
     puts("Bind done");
 
     // Listen for incoming connections
-    /* The `listen(master, 3);` line is used to make the server socket `master` start listening for
-    incoming connections. The second parameter `3` specifies the maximum number of pending
-    connections that can be queued up before the server starts rejecting new connections. In this
-    case, it means that the server can handle up to 3 pending connections before it starts rejecting
-    new connections. */
-    listen(master, 3);
+    /* The `listen(master, SOMAXCONN);` line is used to make the server socket `master` start
+    listening for incoming connections. The second parameter specifies the maximum number of
+    pending connections that can be queued up before the server starts rejecting new connections.
+    SOMAXCONN asks for the largest queue the system allows, so a burst of clients connecting at
+    once waits in the queue instead of being refused. */
+    listen(master, SOMAXCONN);
 
     // Accept and incoming connection
     puts("Waiting for incoming connections...");
@@ -134,9 +134,9 @@ int main()
     // The listen function is used to make the server socket ready to accept incoming connection requests.
     // It has two parameters:
     // - serverSocket: the socket that was created with the socket function and bound to a local address with bind.
-    // - 3: the maximum length of the queue of pending connections. If a connection request arrives when the queue is full, the client may receive an error with an indication of ECONNREFUSED.
+    // - SOMAXCONN: the maximum length of the queue of pending connections, as large as the system allows. If a connection request arrives when the queue is full, the client may receive an error with an indication of ECONNREFUSED.
     // This function does not return a value.
-    listen(serverSocket, 3);
+    listen(serverSocket, SOMAXCONN);
 
     // This is an infinite loop that will keep the server running and ready to accept incoming connections
     while (1)